@@ -32,6 +32,11 @@
 
 #include "contiki.h"
 
+#if MAC_CONF_WITH_TSCH
+#include "net/mac/tsch/tsch.h"
+#include "ssn-tsch.h"
+#endif
+
 /* Log configuration */
 #include "sys/log.h"
 #define LOG_MODULE "RPL BR"
@@ -51,6 +56,13 @@ PROCESS_THREAD(contiki_ng_br, ev, data)
   process_start(&webserver_nogui_process, NULL);
 #endif /* BORDER_ROUTER_CONF_WEBSERVER */
 
+#if MAC_CONF_WITH_TSCH
+  // The network synchronises on us, the batches of the CHs come in the uplink cells
+  ssn_tsch_init();
+  ssn_tsch_listen_uplinks();
+  tsch_set_coordinator(1);
+#endif
+
   LOG_INFO("Contiki-NG Border Router started\n");
 
   PROCESS_END();
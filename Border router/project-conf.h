@@ -43,4 +43,12 @@
 #define UIP_CONF_TCP 1
 #endif
 
+#if MAC_CONF_WITH_TSCH
+/* The cluster schedule of ssn-tsch replaces the 6TiSCH minimal one */
+#define TSCH_SCHEDULE_CONF_WITH_6TISCH_MINIMAL 0
+#define TSCH_SCHEDULE_CONF_MAX_SLOTFRAMES 2
+/* The shared cell and the uplink cells of the cluster heads */
+#define TSCH_SCHEDULE_CONF_MAX_LINKS 5
+#endif
+
 #endif /* PROJECT_CONF_H_ */
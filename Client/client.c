@@ -33,6 +33,7 @@
 #include "net/ipv6/uip-ds6.h"
 #include "net/ipv6/uip-udp-packet.h"
 #include "node-id.h"
+#include "lib/random.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -43,6 +44,17 @@
 #include "sys/log.h"
 
 #include "cc2420.h"
+#include "ssn-proto.h"
+#include "ssn-energy.h"
+#include "link-table.h"
+#include "sensing.h"
+#include "retx-window.h"
+#include "ssn-tsch.h"
+
+#if CLIENT_CONF_BOOT_EPOCH_CFS
+#include "cfs/cfs.h"
+#define BOOT_FILE "boot"
+#endif
 
 #define UDP_CLIENT_LISTENING_PORT 8765
 #define UDP_CH_LISTENING_PORT 6666
@@ -51,35 +63,79 @@
 #include "net/ipv6/uip-debug.h"
 
 #define MCAST_SINK_UDP_PORT 3001 /* Host byte order */
+#define MCAST_SINK_UDP_PORT_CH 3002
 
-#define SETUP_INTERVAL (150 * CLOCK_SECOND)
-#define SEND_INTERVAL (31 * CLOCK_SECOND)
-#define MAX_PAYLOAD_LEN 100
+/* First and longest wait between two solicitations while no CH is known */
+#define SOLICIT_INTERVAL_MIN (2 * CLOCK_SECOND)
+#define SOLICIT_INTERVAL_MAX (32 * CLOCK_SECOND)
+/* A backoff request of the CH lapses if it is not repeated */
+#define BACKOFF_TIMEOUT (180 * CLOCK_SECOND)
 
 static struct uip_udp_conn *ch_conn;
 static struct uip_udp_conn *multicast_conn;
+static struct uip_udp_conn *solicit_conn;
 static uip_ipaddr_t ch_ipaddr;
 
+static struct etimer sample_et;
+static struct ctimer solicit_timer;
+static clock_time_t solicit_interval = SOLICIT_INTERVAL_MIN;
+
 /*---------------------------------------------------------------------------*/
 PROCESS(udp_client_process, "UDP client process");
 AUTOSTART_PROCESSES(&udp_client_process);
 /*---------------------------------------------------------------------------*/
-static uint8_t transmission_power = 31;
-static int16_t best_rssi = -200; // Set to a minimum so it will be changed from the first packet received by CH
-
-/*---------------------------------------------------------------------------*/
-static signed char
-calculate_RSSI(uip_ipaddr_t originator_ipaddr)
+/* CC2420 PA levels and their output power, from the datasheet */
+static const struct
 {
-  static signed char rss;
-  rss = cc2420_last_rssi;
-
-  PRINTF("RSSI of Last Packet Received is %d dBm from ", rss);
-  PRINT6ADDR(&originator_ipaddr);
-  PRINTF("\n");
-
-  return rss;
-}
+  uint8_t level;
+  int8_t dbm;
+} pa_levels[] = {
+    {3, -25}, {7, -15}, {11, -10}, {15, -7}, {19, -5}, {23, -3}, {27, -1}, {31, 0}};
+#define PA_LEVELS (sizeof(pa_levels) / sizeof(pa_levels[0]))
+
+static uint8_t power_index = PA_LEVELS - 1;
+static uint8_t power_sent = PA_LEVELS - 1; // Power of the last data packet
+static uint8_t power_converged = 0;
+static struct ctimer reassoc_timer;
+static uint16_t seq = 0;
+static uint8_t boot_epoch; // Tells the collector that seq started again from 0
+static uint16_t report_seq = 0;
+static uint8_t backoff_shift = 0;
+static clock_time_t sample_base = CLIENT_CONF_SAMPLE_INTERVAL; // Set by the CH in the RSSI echo
+static clock_time_t backoff_received;
+
+#if CLIENT_CONF_SAMPLE_RING > SSN_BATCH_MAX
+#error "CLIENT_CONF_SAMPLE_RING must fit a single batch"
+#endif
+
+/* Samples not reported yet, oldest first from ring_head */
+static ssn_record_t ring[CLIENT_CONF_SAMPLE_RING];
+static clock_time_t ring_sampled[CLIENT_CONF_SAMPLE_RING];
+static uint8_t ring_head = 0;
+static uint8_t ring_count = 0;
+static unsigned long ring_overwritten = 0;
+static struct ctimer report_timer;
+
+/* Last report, kept until the CH echoes it so it can go to a backup head */
+static uint8_t report_buf[SSN_BATCH_LEN(CLIENT_CONF_SAMPLE_RING)];
+static int report_len = 0;
+static uint16_t echo_seq;
+static uint8_t echo_missed = 0;
+static struct ctimer echo_timer;
+
+/* Uplink window given by the CH: a window opens at slot_anchor every cycle */
+static clock_time_t slot_anchor;
+static uint8_t slot_known = 0;
+
+#if CLIENT_CONF_RELIABLE
+static struct ctimer retx_timer;
+#endif
+
+/* Send on delta, per channel of the acquisition pipeline */
+static const int16_t report_delta[SENSING_CHANNELS] = {CLIENT_CONF_REPORT_DELTA_TEMP, CLIENT_CONF_REPORT_DELTA_ACCEL};
+static int16_t sampled_value[SENSING_CHANNELS];
+static int16_t reported_value[SENSING_CHANNELS];
+static uint8_t reported = 0;
 
 /*---------------------------------------------------------------------------*/
 static uip_ds6_maddr_t *
@@ -113,81 +169,491 @@ join_mcast_group(void)
 
 /*---------------------------------------------------------------------------*/
 static void
-adjust_transmission_power(char *rssi)
+set_power_index(uint8_t index)
+{
+  if (index != power_index)
+  {
+    power_index = index;
+    PRINTF("TPower set to %u (%d dBm)\n", pa_levels[power_index].level, pa_levels[power_index].dbm);
+    cc2420_set_txpower(pa_levels[power_index].level);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+adjust_transmission_power(int8_t rssi_int)
 {
-  uint16_t rssi_int = atoi(rssi);
+  uint8_t i;
+  // Path loss seen by the last packet, sent at the power of power_sent
+  int path_loss = pa_levels[power_sent].dbm - rssi_int;
+
+  PRINTF("The RSSI received from cluster node is %d dBm, path loss %d dB\n", rssi_int, path_loss);
 
+  // Far from the target, e.g. first echo or new CH: jump to the right power
+  if (!power_converged || rssi_int < CLIENT_CONF_RSSI_MIN - CLIENT_CONF_RSSI_JUMP ||
+      rssi_int >= CLIENT_CONF_RSSI_MAX + CLIENT_CONF_RSSI_JUMP)
+  {
+    for (i = 0; i < PA_LEVELS - 1; i++)
+    {
+      // Lowest power whose estimated RSSI reaches the target
+      if (pa_levels[i].dbm - path_loss >= CLIENT_CONF_RSSI_TARGET)
+      {
+        break;
+      }
+    }
+    set_power_index(i);
+    power_converged = 1;
+    return;
+  }
+
+  // Near the target: track slowly, holding inside the window
   // Note that the optimal RSSI to have a reliable packet transmission is: -70 <= TPower < -65
-  PRINTF("The RSSI received from cluster node is %d dBm. TPower is %d\n", rssi_int, transmission_power);
+  if (rssi_int >= CLIENT_CONF_RSSI_MAX && power_sent > 0)
+  {
+    set_power_index(power_sent - 1);
+  }
+  else if (rssi_int < CLIENT_CONF_RSSI_MIN && power_sent < PA_LEVELS - 1)
+  {
+    set_power_index(power_sent + 1);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void report_flush(void *ptr);
+static void solicit_start(void);
+static void echo_timeout(void *ptr);
 
-  if (rssi_int >= -65 && transmission_power > 2)
+/*---------------------------------------------------------------------------*/
+static void
+set_head(const uip_ipaddr_t *addr)
+{
+  if (uip_is_addr_unspecified(&ch_ipaddr) && ring_count > 0)
   {
-    transmission_power -= 2;
-    PRINTF("Lowering TPower to %d\n", transmission_power);
-    cc2420_set_txpower(transmission_power);
+    // No head was known: report what was sampled in the meantime
+    ctimer_set(&report_timer, rand() % CLOCK_SECOND + 1, report_flush, NULL);
   }
+  ch_ipaddr = *addr;
+  // Send at will until the new head gives us a slot
+  slot_known = 0;
+#if MAC_CONF_WITH_TSCH
+  ssn_tsch_set_slot(SSN_SLOT_NONE, NULL);
+#endif
+  ctimer_stop(&echo_timer);
+  echo_missed = 0;
+  // The path loss is unknown: start at full power, the first echo sets it
+  set_power_index(PA_LEVELS - 1);
+  power_converged = 0;
+}
 
-  if (rssi_int < -70)
+/*---------------------------------------------------------------------------*/
+static void
+report_send(void)
+{
+  power_sent = power_index;
+  uip_udp_packet_sendto(ch_conn, report_buf, report_len, &ch_ipaddr, UIP_HTONS(UDP_CH_LISTENING_PORT));
+  // The RSSI echo doubles as the acknowledgement of the report
+  ctimer_set(&echo_timer, CLIENT_CONF_ECHO_TIMEOUT, echo_timeout, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+echo_timeout(void *ptr)
+{
+  link_candidate_t *backup;
+
+  echo_missed++;
+  PRINTF("No echo for report %u, %u missed\n", echo_seq, echo_missed);
+
+  // The report may just have been sent too weakly
+  set_power_index(PA_LEVELS - 1);
+  power_converged = 0;
+
+  if (echo_missed < CLIENT_CONF_ECHO_MISSES)
   {
-    if (transmission_power < 31)
-    {
-      transmission_power++;
-      PRINTF("Increasing TPower to %d\n", transmission_power);
-      cc2420_set_txpower(transmission_power);
-    }
-    else
+    return;
+  }
+
+  // The head looks dead, do not wait for the next round to leave it
+  link_table_remove(&ch_ipaddr);
+  backup = link_table_backup(&ch_ipaddr);
+  if (backup == NULL)
+  {
+    PRINTF("CH lost and no backup known, soliciting beacons\n");
+    uip_create_unspecified(&ch_ipaddr);
+    solicit_start();
+    return;
+  }
+
+  PRINTF("CH lost, failing over to ");
+  PRINT6ADDR(&backup->addr);
+  PRINTF(" with score %d\n", link_table_score(backup));
+  set_head(&backup->addr);
+  // The unacknowledged report goes to the backup, duplicates are dropped upstream
+  report_send();
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+reassociate(void *ptr)
+{
+  link_candidate_t *best = link_table_select(&ch_ipaddr);
+
+  if (best == NULL)
+  {
+    PRINTF("No cluster head heard in this round\n");
+  }
+  else if (!uip_ipaddr_cmp(&best->addr, &ch_ipaddr))
+  {
+    set_head(&best->addr);
+    PRINTF("The new CH is ");
+    PRINT6ADDR(&ch_ipaddr);
+    PRINTF(" with score %d\n", link_table_score(best));
+  }
+  else
+  {
+    PRINTF("The best CH has been already set\n");
+  }
+}
+
+#if CLIENT_CONF_RELIABLE
+/*---------------------------------------------------------------------------*/
+static void
+retx_flush(void *ptr)
+{
+  uint8_t buf[SSN_BATCH_LEN(SSN_BATCH_MAX)];
+  int n;
+
+  if (!uip_is_addr_unspecified(&ch_ipaddr) &&
+      (n = retx_window_collect(&buf[SSN_BATCH_LEN(0)], SSN_BATCH_MAX)) > 0)
+  {
+    ssn_hdr_write(buf, SSN_MSG_BATCH, node_id, report_seq++);
+    buf[SSN_HDR_LEN] = n;
+    PRINTF("Retransmitting %d readings, %lu sent and %lu given up so far\n",
+           n, retx_window_sent(), retx_window_abandoned());
+    power_sent = power_index;
+    uip_udp_packet_sendto(ch_conn, buf, SSN_BATCH_LEN(n), &ch_ipaddr, UIP_HTONS(UDP_CH_LISTENING_PORT));
+  }
+
+  if (retx_window_length() > 0)
+  {
+    ctimer_set(&retx_timer, CLIENT_CONF_RETX_TIMEOUT, retx_flush, NULL);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+sack_received(const uint8_t *appdata, int len)
+{
+  int i;
+  const uint8_t *entry = &appdata[SSN_SACK_LEN(0)];
+
+  for (i = 0; i < appdata[SSN_HDR_LEN] && len >= SSN_SACK_LEN(i + 1); i++, entry += SSN_SACK_ENTRY_LEN)
+  {
+    if (ssn_get_u16(&entry[0]) == node_id &&
+        retx_window_sack(ssn_get_u16(&entry[2]), ssn_get_u16(&entry[4])) > 0)
     {
-      PRINTF("The TPower is already at max value\n");
+      // Send the missing readings soon, jittered like the other replies
+      ctimer_set(&retx_timer, rand() % CLOCK_SECOND + 1, retx_flush, NULL);
     }
   }
 }
+#endif /* CLIENT_CONF_RELIABLE */
+
+/*---------------------------------------------------------------------------*/
+static void
+interval_received(uint16_t seconds)
+{
+  clock_time_t interval = (clock_time_t)seconds * CLOCK_SECOND;
+
+  // 0 leaves the interval to the client
+  if (seconds == 0 || interval == sample_base)
+  {
+    return;
+  }
+
+  PRINTF("Sample interval %u s requested by the CH\n", seconds);
+  sample_base = interval;
+  sensing_set_interval(sample_base);
+}
 
 /*---------------------------------------------------------------------------*/
 static void
 tcpip_handler(void)
 {
-  char *appdata;
+  uint8_t *appdata;
+  ssn_hdr_t hdr;
 
   if (uip_newdata())
   {
-    appdata = (char *)uip_appdata;
-    appdata[uip_datalen()] = '\0';
+    appdata = (uint8_t *)uip_appdata;
+
+    if (!ssn_hdr_read(appdata, uip_datalen(), &hdr))
+    {
+      PRINTF("Dropping a message with an unknown format\n");
+      return;
+    }
 
-    if (strcmp(appdata, "CH") == 0)
+    switch (hdr.type)
     {
-      signed char rssi_tmp = calculate_RSSI(UIP_IP_BUF->srcipaddr);
-      if (rssi_tmp > best_rssi)
+    case SSN_MSG_BEACON:
+      if (link_table_beacon(&UIP_IP_BUF->srcipaddr, hdr.seq, cc2420_last_rssi, cc2420_last_correlation))
       {
-        best_rssi = rssi_tmp;
-        ch_ipaddr = UIP_IP_BUF->srcipaddr;
-        PRINTF("The new CH is ");
-        PRINT6ADDR(&ch_ipaddr);
-        PRINTF("\n");
+        // Re-associate once the beacons of this round have had time to arrive
+        ctimer_set(&reassoc_timer, CLIENT_CONF_REASSOC_DELAY, reassociate, NULL);
       }
-      else
+      if (uip_is_addr_unspecified(&ch_ipaddr))
       {
-        PRINTF("The best CH has been already set\n");
+        // Report to the first head heard while waiting for the others
+        reassociate(NULL);
       }
+      break;
+
+    case SSN_MSG_BACKOFF:
+      if (uip_datalen() >= SSN_BACKOFF_LEN && uip_ipaddr_cmp(&UIP_IP_BUF->srcipaddr, &ch_ipaddr))
+      {
+        // Our CH cannot reach the border router, slow down until it drains its queue
+        backoff_shift = appdata[SSN_HDR_LEN] < 4 ? appdata[SSN_HDR_LEN] : 4;
+        backoff_received = clock_time();
+        PRINTF("Backoff %u requested by the CH\n", backoff_shift);
+      }
+      break;
+
+    case SSN_MSG_SACK:
+#if CLIENT_CONF_RELIABLE
+      if (uip_datalen() > SSN_HDR_LEN)
+      {
+        // The collector acknowledged readings, relayed by our CH
+        sack_received(appdata, uip_datalen());
+      }
+#endif
+      break;
+
+    case SSN_MSG_RSSI_ECHO:
+      if (uip_datalen() >= SSN_RSSI_ECHO_LEN && uip_ipaddr_cmp(&UIP_IP_BUF->srcipaddr, &ch_ipaddr))
+      {
+        if (hdr.seq == echo_seq)
+        {
+          // Our head is alive
+          ctimer_stop(&echo_timer);
+          echo_missed = 0;
+        }
+        // The CH sent back the RSSI value of our last packet
+        adjust_transmission_power((int8_t)appdata[SSN_HDR_LEN]);
+#if MAC_CONF_WITH_TSCH
+        ssn_tsch_set_slot(appdata[SSN_HDR_LEN + 1], &ch_ipaddr);
+#else
+        // Our window opens the given delay after the CH sent the echo
+        slot_known = (appdata[SSN_HDR_LEN + 1] != SSN_SLOT_NONE);
+        slot_anchor = clock_time() + (clock_time_t)ssn_get_u16(&appdata[SSN_HDR_LEN + 2]) * CLOCK_SECOND / 1000;
+#endif
+        interval_received(ssn_get_u16(&appdata[SSN_HDR_LEN + 4]));
+      }
+      break;
+
+    default:
+      PRINTF("Ignoring message type %u\n", hdr.type);
+      break;
     }
-    else
-    {
-      // It means that the CH sent back the RSSI value to the client
-      adjust_transmission_power(appdata);
-    }
   }
 }
 
+/*---------------------------------------------------------------------------*/
+static clock_time_t
+sample_interval(void)
+{
+  if (backoff_shift > 0 && clock_time() - backoff_received > BACKOFF_TIMEOUT)
+  {
+    backoff_shift = 0;
+  }
+
+  return sample_base << backoff_shift;
+}
+
+/*---------------------------------------------------------------------------*/
+static clock_time_t
+slot_wait(void)
+{
+  clock_time_t cycle = (clock_time_t)SSN_SLOT_CYCLE_MS * CLOCK_SECOND / 1000;
+  clock_time_t window = (clock_time_t)SSN_SLOT_WINDOW_MS * CLOCK_SECOND / 1000;
+  long elapsed;
+
+  if (!slot_known)
+  {
+    return 0;
+  }
+
+  elapsed = (long)(clock_time() - slot_anchor) % (long)cycle;
+  if (elapsed < 0)
+  {
+    elapsed += cycle;
+  }
+
+  // Only the first half of the window is used, the rest absorbs the clock drift
+  return elapsed < window / 2 ? 0 : cycle - elapsed;
+}
+
 /*---------------------------------------------------------------------------*/
 static void
-send_packet(void *ptr)
+report_flush(void *ptr)
 {
-  char buf[MAX_PAYLOAD_LEN];
+  ssn_record_t *record;
+  clock_time_t now = clock_time();
+  clock_time_t wait;
+  uint8_t i;
+
+  ctimer_stop(&report_timer);
+
+  if (ring_count == 0)
+  {
+    return;
+  }
 
-  sprintf(buf, "Client node ID = %d", node_id);
-  PRINTF("Sending data '%s' to ", buf);
+  if (uip_is_addr_unspecified(&ch_ipaddr))
+  {
+    // Keep the samples until a head is known, reassociate() flushes them
+    return;
+  }
+
+  if ((wait = slot_wait()) > 0)
+  {
+    // Hold the report until our uplink window, the other clients of the cluster have theirs
+    ctimer_set(&report_timer, wait, report_flush, NULL);
+    return;
+  }
+
+  for (i = 0; i < ring_count; i++)
+  {
+    record = &ring[(ring_head + i) % CLIENT_CONF_SAMPLE_RING];
+    record->age = ssn_age_add(0, (now - ring_sampled[(ring_head + i) % CLIENT_CONF_SAMPLE_RING]) * 10 / CLOCK_SECOND);
+#if CLIENT_CONF_RELIABLE
+    // The collector acknowledges the reading, until then it stays in the window
+    record->kind |= SSN_KIND_ACK_REQ;
+    retx_window_add(record, ring_sampled[(ring_head + i) % CLIENT_CONF_SAMPLE_RING]);
+#endif
+  }
+
+  if (ring_count == 1)
+  {
+    // A lone sample goes out as DATA, four bytes shorter than a batch
+    report_len = ssn_data_write(report_buf, &ring[ring_head]);
+    echo_seq = ring[ring_head].seq;
+  }
+  else
+  {
+    echo_seq = report_seq++;
+    ssn_hdr_write(report_buf, SSN_MSG_BATCH, node_id, echo_seq);
+    report_buf[SSN_HDR_LEN] = ring_count;
+    for (i = 0; i < ring_count; i++)
+    {
+      ssn_record_write(&report_buf[SSN_BATCH_LEN(i)], &ring[(ring_head + i) % CLIENT_CONF_SAMPLE_RING]);
+    }
+    report_len = SSN_BATCH_LEN(ring_count);
+  }
+
+  PRINTF("Reporting %u samples to ", ring_count);
   PRINT6ADDR(&ch_ipaddr);
   PRINTF("\n");
-  uip_udp_packet_sendto(ch_conn, buf, strlen(buf), &ch_ipaddr, UIP_HTONS(UDP_CH_LISTENING_PORT));
+  report_send();
+
+#if CLIENT_CONF_RELIABLE
+  if (ctimer_expired(&retx_timer))
+  {
+    ctimer_set(&retx_timer, CLIENT_CONF_RETX_TIMEOUT, retx_flush, NULL);
+  }
+#endif
+
+  // The newest reading of every channel was in this report
+  memcpy(reported_value, sampled_value, sizeof(reported_value));
+  reported = 1;
+  ring_head = 0;
+  ring_count = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+sample(void)
+{
+  ssn_record_t *record;
+  uint8_t slot;
+  uint8_t channel;
+  uint8_t moved = !reported;
+  uint8_t was_empty = (ring_count == 0);
+
+  for (channel = 0; channel < SENSING_CHANNELS; channel++)
+  {
+    if (ring_count == CLIENT_CONF_SAMPLE_RING)
+    {
+      // Still no head to report to, the oldest reading makes room
+      ring_head = (ring_head + 1) % CLIENT_CONF_SAMPLE_RING;
+      ring_count--;
+      ring_overwritten++;
+      PRINTF("Sample ring full, %lu readings overwritten\n", ring_overwritten);
+    }
+
+    // Decimation: the filtered value is taken once per sample interval
+    sampled_value[channel] = sensing_value(channel);
+    if (report_delta[channel] > 0 && abs(sampled_value[channel] - reported_value[channel]) > report_delta[channel])
+    {
+      moved = 1;
+    }
+
+    slot = (ring_head + ring_count) % CLIENT_CONF_SAMPLE_RING;
+    record = &ring[slot];
+    record->node_id = node_id;
+    record->seq = seq++;
+    record->kind = sensing_kind(channel) | (boot_epoch << SSN_KIND_EPOCH_SHIFT);
+    record->value = sampled_value[channel];
+    record->age = 0;
+    ring_sampled[slot] = clock_time();
+    ring_count++;
+  }
+
+  if (ring_count >= CLIENT_CONF_REPORT_BATCH)
+  {
+    report_flush(NULL);
+  }
+  else if (moved)
+  {
+    // Send on delta: a change is reported right away with the samples before it
+    report_flush(NULL);
+  }
+  else if (was_empty)
+  {
+    // The staleness deadline starts with the oldest sample in the ring
+    ctimer_set(&report_timer, CLIENT_CONF_REPORT_STALENESS, report_flush, NULL);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+send_solicit(void *ptr)
+{
+  uint8_t buf[SSN_HDR_LEN];
+
+  if (!uip_is_addr_unspecified(&ch_ipaddr))
+  {
+    return;
+  }
+
+  // Ask the active heads for a beacon instead of waiting for the next round
+  ssn_hdr_write(buf, SSN_MSG_SOLICIT, node_id, 0);
+  PRINTF("Soliciting a beacon from the cluster heads\n");
+  uip_udp_packet_send(solicit_conn, buf, sizeof(buf));
+
+  ctimer_set(&solicit_timer, solicit_interval, send_solicit, NULL);
+  if (solicit_interval < SOLICIT_INTERVAL_MAX)
+  {
+    solicit_interval *= 2;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+solicit_start(void)
+{
+  // Solicitations repeat with exponential backoff until a head is known
+  solicit_interval = SOLICIT_INTERVAL_MIN;
+  ctimer_set(&solicit_timer, rand() % CLOCK_SECOND + 1, send_solicit, NULL);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -215,10 +681,48 @@ print_local_addresses(void)
   }
 }
 
+/*---------------------------------------------------------------------------*/
+static void
+boot_epoch_init(void)
+{
+#if CLIENT_CONF_BOOT_EPOCH_CFS
+  uint8_t count = 0;
+  int fd;
+
+  fd = cfs_open(BOOT_FILE, CFS_READ);
+  if (fd >= 0)
+  {
+    if (cfs_read(fd, &count, sizeof(count)) != sizeof(count))
+    {
+      count = 0;
+    }
+    cfs_close(fd);
+  }
+
+  count++;
+  fd = cfs_open(BOOT_FILE, CFS_WRITE);
+  if (fd >= 0)
+  {
+    if (cfs_write(fd, &count, sizeof(count)) == sizeof(count))
+    {
+      cfs_close(fd);
+      boot_epoch = count % SSN_KIND_EPOCHS;
+      PRINTF("Boot %u, epoch %u\n", count, boot_epoch);
+      return;
+    }
+    cfs_close(fd);
+  }
+#endif
+
+  // No boot count: a random epoch still differs from the last one 3 times out of 4
+  boot_epoch = random_rand() % SSN_KIND_EPOCHS;
+  PRINTF("Boot epoch %u\n", boot_epoch);
+}
+
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(udp_client_process, ev, data)
 {
-  static struct etimer periodic;
+  uip_ipaddr_t mcast_addr;
 
   PROCESS_BEGIN();
 
@@ -226,6 +730,17 @@ PROCESS_THREAD(udp_client_process, ev, data)
 
   print_local_addresses();
 
+  ssn_energy_init();
+  boot_epoch_init();
+#if MAC_CONF_WITH_TSCH
+  ssn_tsch_init();
+#endif
+  sensing_init();
+  link_table_init();
+#if CLIENT_CONF_RELIABLE
+  retx_window_init();
+#endif
+
   ch_conn = udp_new(NULL, UIP_HTONS(UDP_CH_LISTENING_PORT), NULL);
   multicast_conn = udp_new(NULL, UIP_HTONS(0), NULL);
 
@@ -243,7 +758,12 @@ PROCESS_THREAD(udp_client_process, ev, data)
   PRINTF(" local/remote port %u/%u\n",
          UIP_HTONS(ch_conn->lport), UIP_HTONS(ch_conn->rport));
 
-  etimer_set(&periodic, SETUP_INTERVAL);
+  uip_ip6addr(&mcast_addr, 0xFF1E, 0, 0, 0, 0, 0, 0x89, 0xABCD);
+  solicit_conn = udp_new(&mcast_addr, UIP_HTONS(MCAST_SINK_UDP_PORT_CH), NULL);
+
+  // Sampling starts right away, the first solicitation is jittered
+  etimer_set(&sample_et, CLIENT_CONF_SAMPLE_INTERVAL);
+  solicit_start();
 
   while (1)
   {
@@ -253,10 +773,10 @@ PROCESS_THREAD(udp_client_process, ev, data)
       tcpip_handler();
     }
 
-    if (etimer_expired(&periodic))
+    if (etimer_expired(&sample_et))
     {
-      etimer_set(&periodic, SEND_INTERVAL);
-      send_packet(NULL);
+      etimer_set(&sample_et, sample_interval());
+      sample();
     }
   }
   PROCESS_END();
@@ -0,0 +1,181 @@
+#include "contiki.h"
+#include "link-table.h"
+
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ipv6/uip-debug.h"
+
+static link_candidate_t table[CLIENT_CONF_LINK_CANDIDATES];
+static uint16_t current_round = 0;
+static uint8_t round_known = 0;
+
+/*---------------------------------------------------------------------------*/
+void
+link_table_init(void)
+{
+  memset(table, 0, sizeof(table));
+  round_known = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+link_table_score(const link_candidate_t *c)
+{
+  // RSSI in dB, up to -10 dB for a poor LQI and -20 dB for lost beacons
+  int lqi_penalty = c->lqi < 105 ? (105 - c->lqi) / 5 : 0;
+  int loss_penalty = (255 - c->reception) * 20 / 255;
+
+  return c->rssi / 16 - (lqi_penalty > 10 ? 10 : lqi_penalty) - loss_penalty;
+}
+
+/*---------------------------------------------------------------------------*/
+link_candidate_t *
+link_table_lookup(const uip_ipaddr_t *addr)
+{
+  int i;
+
+  for (i = 0; i < CLIENT_CONF_LINK_CANDIDATES; i++)
+  {
+    if (table[i].used && uip_ipaddr_cmp(&table[i].addr, addr))
+    {
+      return &table[i];
+    }
+  }
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+static link_candidate_t *
+candidate_add(const uip_ipaddr_t *addr)
+{
+  int i;
+  link_candidate_t *victim = NULL;
+
+  for (i = 0; i < CLIENT_CONF_LINK_CANDIDATES; i++)
+  {
+    if (!table[i].used)
+    {
+      victim = &table[i];
+      break;
+    }
+    // Otherwise replace the worst candidate
+    if (victim == NULL || link_table_score(&table[i]) < link_table_score(victim))
+    {
+      victim = &table[i];
+    }
+  }
+
+  memset(victim, 0, sizeof(*victim));
+  victim->used = 1;
+  uip_ipaddr_copy(&victim->addr, addr);
+  return victim;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+link_table_beacon(const uip_ipaddr_t *addr, uint16_t round, int8_t rssi, uint8_t lqi)
+{
+  int i;
+  int new_round = 0;
+  link_candidate_t *c;
+
+  if (!round_known || (int16_t)(round - current_round) > 0)
+  {
+    // Close the previous round: a candidate that did not beacon lost it
+    for (i = 0; i < CLIENT_CONF_LINK_CANDIDATES; i++)
+    {
+      if (table[i].used && table[i].last_round != current_round)
+      {
+        table[i].reception -= table[i].reception / 4;
+      }
+    }
+    current_round = round;
+    round_known = 1;
+    new_round = 1;
+  }
+  else if (round != current_round)
+  {
+    // A beacon of a past round says nothing about the current heads
+    return 0;
+  }
+
+  c = link_table_lookup(addr);
+  if (c == NULL)
+  {
+    c = candidate_add(addr);
+    c->rssi = rssi * 16;
+    c->lqi = lqi;
+    c->reception = 255;
+  }
+  else if (c->last_round != round)
+  {
+    // Moving averages with a weight of 1/4 for the new sample
+    c->rssi += (rssi * 16 - c->rssi) / 4;
+    c->lqi = (3 * c->lqi + lqi) / 4;
+    c->reception += (255 - c->reception) / 4;
+  }
+  c->last_round = round;
+
+  PRINTF("Beacon round %u RSSI %d LQI %u, candidate score %d\n", round, rssi, lqi, link_table_score(c));
+  return new_round;
+}
+
+/*---------------------------------------------------------------------------*/
+link_candidate_t *
+link_table_select(const uip_ipaddr_t *current)
+{
+  int i;
+  link_candidate_t *best = NULL;
+  link_candidate_t *cur = link_table_lookup(current);
+
+  for (i = 0; i < CLIENT_CONF_LINK_CANDIDATES; i++)
+  {
+    if (table[i].used && table[i].last_round == current_round &&
+        (best == NULL || link_table_score(&table[i]) > link_table_score(best)))
+    {
+      best = &table[i];
+    }
+  }
+
+  if (best != NULL && cur != NULL && cur != best && cur->last_round == current_round &&
+      link_table_score(best) < link_table_score(cur) + CLIENT_CONF_LINK_HYSTERESIS)
+  {
+    // Not better enough to be worth a switch
+    return cur;
+  }
+
+  return best;
+}
+
+/*---------------------------------------------------------------------------*/
+link_candidate_t *
+link_table_backup(const uip_ipaddr_t *current)
+{
+  int i;
+  link_candidate_t *best = NULL;
+
+  for (i = 0; i < CLIENT_CONF_LINK_CANDIDATES; i++)
+  {
+    if (table[i].used && table[i].last_round == current_round && !uip_ipaddr_cmp(&table[i].addr, current) &&
+        (best == NULL || link_table_score(&table[i]) > link_table_score(best)))
+    {
+      best = &table[i];
+    }
+  }
+
+  return best;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+link_table_remove(const uip_ipaddr_t *addr)
+{
+  link_candidate_t *c = link_table_lookup(addr);
+
+  if (c != NULL)
+  {
+    c->used = 0;
+  }
+}
@@ -0,0 +1,56 @@
+/*
+ * Link estimator of the cluster heads this client can hear.
+ *
+ * For each candidate in a small fixed table, the client keeps a moving
+ * average of the RSSI and LQI of its beacons and of the share of rounds in
+ * which one of its beacons was received. Candidates are ranked on a score
+ * expressed in dB.
+ */
+
+#ifndef LINK_TABLE_H_
+#define LINK_TABLE_H_
+
+#include "contiki.h"
+#include "net/ipv6/uip.h"
+
+typedef struct link_candidate
+{
+  uip_ipaddr_t addr;
+  uint8_t used;
+  int16_t rssi;       // Moving average in 1/16 dBm
+  uint8_t lqi;        // Moving average of the CC2420 correlation value
+  uint8_t reception;  // Moving average of the beacons received per round, 255 = all
+  uint16_t last_round; // Last round in which a beacon was received
+} link_candidate_t;
+
+void link_table_init(void);
+
+/*
+ * Records a beacon. Returns 1 if it is the first beacon of a new round, the
+ * previous round is then closed and its missing beacons counted as lost.
+ */
+int link_table_beacon(const uip_ipaddr_t *addr, uint16_t round, int8_t rssi, uint8_t lqi);
+
+/* Score of a candidate in dB, higher is better */
+int link_table_score(const link_candidate_t *c);
+
+/* Candidate with this address, or NULL */
+link_candidate_t *link_table_lookup(const uip_ipaddr_t *addr);
+
+/*
+ * Best candidate that beaconed in the current round. The current head is
+ * kept unless the best one scores CLIENT_CONF_LINK_HYSTERESIS dB more, or
+ * it did not beacon in this round. Returns NULL if no candidate qualifies.
+ */
+link_candidate_t *link_table_select(const uip_ipaddr_t *current);
+
+/*
+ * Best candidate other than the current head that beaconed in the current
+ * round, without hysteresis. Returns NULL if there is none.
+ */
+link_candidate_t *link_table_backup(const uip_ipaddr_t *current);
+
+/* Forgets a head that stopped answering, a new beacon brings it back */
+void link_table_remove(const uip_ipaddr_t *addr);
+
+#endif /* LINK_TABLE_H_ */
@@ -34,6 +34,125 @@
 #define NETSTACK_CONF_WITH_IPV6  1
 #endif
 
+#if MAC_CONF_WITH_TSCH
+/* The cluster schedule of ssn-tsch replaces the 6TiSCH minimal one */
+#define TSCH_SCHEDULE_CONF_WITH_6TISCH_MINIMAL 0
+#define TSCH_SCHEDULE_CONF_MAX_SLOTFRAMES 2
+#define TSCH_SCHEDULE_CONF_MAX_LINKS 2
+/* A client runs no routing, it follows the EBs of the cluster heads */
+#define TSCH_CONF_AUTOSELECT_TIME_SOURCE 1
+#endif
+
+/* Cluster heads tracked by the link estimator */
+#ifndef CLIENT_CONF_LINK_CANDIDATES
+#define CLIENT_CONF_LINK_CANDIDATES 4
+#endif
+
+/* Score margin in dB a new head needs over the current one */
+#ifndef CLIENT_CONF_LINK_HYSTERESIS
+#define CLIENT_CONF_LINK_HYSTERESIS 6
+#endif
+
+/* Time given to the beacons of a round before the client re-associates */
+#ifndef CLIENT_CONF_REASSOC_DELAY
+#define CLIENT_CONF_REASSOC_DELAY (2 * CLOCK_SECOND)
+#endif
+
+/* The RSSI echo acknowledges a report, after this many missing echoes the
+ * client fails over to the second-best head */
+#ifndef CLIENT_CONF_ECHO_TIMEOUT
+#define CLIENT_CONF_ECHO_TIMEOUT (2 * CLOCK_SECOND)
+#endif
+#ifndef CLIENT_CONF_ECHO_MISSES
+#define CLIENT_CONF_ECHO_MISSES 3
+#endif
+
+/* RSSI window at the CH the transmit power controller aims for, in dBm */
+#ifndef CLIENT_CONF_RSSI_TARGET
+#define CLIENT_CONF_RSSI_TARGET -67
+#endif
+#ifndef CLIENT_CONF_RSSI_MIN
+#define CLIENT_CONF_RSSI_MIN -70
+#endif
+#ifndef CLIENT_CONF_RSSI_MAX
+#define CLIENT_CONF_RSSI_MAX -65
+#endif
+/* Beyond this distance from the window the controller jumps again */
+#ifndef CLIENT_CONF_RSSI_JUMP
+#define CLIENT_CONF_RSSI_JUMP 6
+#endif
+
+/* Time between two samples until the CH sets it, PERIOD in seconds from the
+ * Makefile. The backoff of the CH stretches it. */
+#ifndef CLIENT_CONF_SAMPLE_INTERVAL
+#ifdef PERIOD
+#define CLIENT_CONF_SAMPLE_INTERVAL (PERIOD * CLOCK_SECOND)
+#else
+#define CLIENT_CONF_SAMPLE_INTERVAL (15 * CLOCK_SECOND)
+#endif
+#endif
+
+/* Raw sensor reads per sample interval, the filter output is decimated to one */
+#ifndef CLIENT_CONF_SENSE_OVERSAMPLE
+#define CLIENT_CONF_SENSE_OVERSAMPLE 8
+#endif
+
+/* The low-pass filter moves by 1/2^shift of the error on every raw read */
+#ifndef CLIENT_CONF_SENSE_FILTER_SHIFT
+#define CLIENT_CONF_SENSE_FILTER_SHIFT 2
+#endif
+
+/* Records buffered while waiting for a report, one per channel and sample,
+ * at most SSN_BATCH_MAX */
+#ifndef CLIENT_CONF_SAMPLE_RING
+#define CLIENT_CONF_SAMPLE_RING 8
+#endif
+
+/* Records that make a full batch */
+#ifndef CLIENT_CONF_REPORT_BATCH
+#define CLIENT_CONF_REPORT_BATCH 8
+#endif
+
+/* A reading this far from the last reported value of its channel is sent
+ * right away, 0 disables it. In 1/100 degree and in mg. */
+#ifndef CLIENT_CONF_REPORT_DELTA_TEMP
+#define CLIENT_CONF_REPORT_DELTA_TEMP 50
+#endif
+#ifndef CLIENT_CONF_REPORT_DELTA_ACCEL
+#define CLIENT_CONF_REPORT_DELTA_ACCEL 100
+#endif
+
+/* Longest time a sample waits in the ring before it is reported */
+#ifndef CLIENT_CONF_REPORT_STALENESS
+#define CLIENT_CONF_REPORT_STALENESS (120 * CLOCK_SECOND)
+#endif
+
+/* Reliable delivery: readings are acknowledged by the collector and sent
+ * again until a SACK covers them */
+#ifndef CLIENT_CONF_RELIABLE
+#define CLIENT_CONF_RELIABLE 0
+#endif
+/* Readings kept for retransmission */
+#ifndef CLIENT_CONF_RETX_WINDOW
+#define CLIENT_CONF_RETX_WINDOW 16
+#endif
+/* A reading no SACK covered after this long is sent again */
+#ifndef CLIENT_CONF_RETX_TIMEOUT
+#define CLIENT_CONF_RETX_TIMEOUT (90 * CLOCK_SECOND)
+#endif
+#ifndef CLIENT_CONF_RETX_MAX
+#define CLIENT_CONF_RETX_MAX 3
+#endif
+
+/* Keep a boot count in a Coffee file, its low bits are the boot epoch of the
+ * readings. Without it the epoch is random at every boot. */
+#ifndef CLIENT_CONF_BOOT_EPOCH_CFS
+#define CLIENT_CONF_BOOT_EPOCH_CFS 1
+#endif
+
+/* Energest accounting for the energy reports */
+#define ENERGEST_CONF_ON 1
+
 // #define LOG_CONF_LEVEL_IPV6                        LOG_LEVEL_DBG
 // #define LOG_CONF_LEVEL_RPL                         LOG_LEVEL_DBG
 // #define LOG_CONF_LEVEL_6LOWPAN                     LOG_LEVEL_DBG
@@ -0,0 +1,159 @@
+#include "contiki.h"
+#include "retx-window.h"
+
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ipv6/uip-debug.h"
+
+typedef struct retx_entry
+{
+  ssn_record_t record;
+  clock_time_t sampled;
+  clock_time_t sent;
+  uint8_t used;
+  uint8_t due;   // A SACK showed it missing
+  uint8_t tries; // Retransmissions so far
+} retx_entry_t;
+
+static retx_entry_t window[CLIENT_CONF_RETX_WINDOW];
+static unsigned long sent = 0;
+static unsigned long abandoned = 0;
+
+/*---------------------------------------------------------------------------*/
+void
+retx_window_init(void)
+{
+  memset(window, 0, sizeof(window));
+}
+
+/*---------------------------------------------------------------------------*/
+void
+retx_window_add(const ssn_record_t *record, clock_time_t sampled)
+{
+  int i;
+  retx_entry_t *slot = NULL;
+
+  for (i = 0; i < CLIENT_CONF_RETX_WINDOW; i++)
+  {
+    if (!window[i].used)
+    {
+      slot = &window[i];
+      break;
+    }
+    // Otherwise the oldest reading makes room
+    if (slot == NULL || (int16_t)(window[i].record.seq - slot->record.seq) < 0)
+    {
+      slot = &window[i];
+    }
+  }
+
+  if (slot->used)
+  {
+    abandoned++;
+    PRINTF("Retransmission window full, giving up seq %u\n", slot->record.seq);
+  }
+
+  memset(slot, 0, sizeof(*slot));
+  slot->record = *record;
+  slot->sampled = sampled;
+  slot->sent = clock_time();
+  slot->used = 1;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+retx_window_sack(uint16_t highest, uint16_t bitmap)
+{
+  int i;
+  int due = 0;
+
+  for (i = 0; i < CLIENT_CONF_RETX_WINDOW; i++)
+  {
+    if (!window[i].used)
+    {
+      continue;
+    }
+
+    if (ssn_sack_covers(highest, bitmap, window[i].record.seq))
+    {
+      window[i].used = 0;
+    }
+    else if ((int16_t)(highest - window[i].record.seq) > 0)
+    {
+      // A newer reading arrived without this one, it was lost on the way
+      window[i].due = 1;
+      due++;
+    }
+  }
+
+  return due;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+retx_window_collect(uint8_t *buf, int max)
+{
+  int i;
+  int n = 0;
+  ssn_record_t record;
+  clock_time_t now = clock_time();
+
+  for (i = 0; i < CLIENT_CONF_RETX_WINDOW && n < max; i++)
+  {
+    if (!window[i].used || (!window[i].due && now - window[i].sent < CLIENT_CONF_RETX_TIMEOUT))
+    {
+      continue;
+    }
+
+    if (window[i].tries >= CLIENT_CONF_RETX_MAX)
+    {
+      window[i].used = 0;
+      abandoned++;
+      PRINTF("Giving up seq %u after %u retransmissions\n", window[i].record.seq, window[i].tries);
+      continue;
+    }
+
+    record = window[i].record;
+    record.kind |= SSN_KIND_RETX;
+    record.age = ssn_age_add(0, (now - window[i].sampled) * 10 / CLOCK_SECOND);
+    ssn_record_write(&buf[n * SSN_RECORD_LEN], &record);
+    n++;
+
+    window[i].due = 0;
+    window[i].tries++;
+    window[i].sent = now;
+    sent++;
+  }
+
+  return n;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+retx_window_length(void)
+{
+  int i;
+  int n = 0;
+
+  for (i = 0; i < CLIENT_CONF_RETX_WINDOW; i++)
+  {
+    n += window[i].used;
+  }
+
+  return n;
+}
+
+/*---------------------------------------------------------------------------*/
+unsigned long
+retx_window_sent(void)
+{
+  return sent;
+}
+
+/*---------------------------------------------------------------------------*/
+unsigned long
+retx_window_abandoned(void)
+{
+  return abandoned;
+}
@@ -0,0 +1,38 @@
+/*
+ * Retransmission window of the reliable delivery mode.
+ *
+ * Readings sent with SSN_KIND_ACK_REQ stay in a small fixed window until a
+ * SACK of the collector covers them. A reading is due again when a SACK
+ * shows a newer one arrived without it, or when no SACK covered it for
+ * CLIENT_CONF_RETX_TIMEOUT. It is given up after CLIENT_CONF_RETX_MAX
+ * retransmissions, or when the window is full and a new reading needs room.
+ */
+
+#ifndef RETX_WINDOW_H_
+#define RETX_WINDOW_H_
+
+#include "contiki.h"
+#include "ssn-proto.h"
+
+void retx_window_init(void);
+
+/* Keeps a reading just sent, sampled at the given clock time */
+void retx_window_add(const ssn_record_t *record, clock_time_t sampled);
+
+/* Applies the SACK entry of this node, returns how many readings are due */
+int retx_window_sack(uint16_t highest, uint16_t bitmap);
+
+/*
+ * Encodes up to max due readings as batch records into buf, flagged as
+ * retransmissions with their age updated. Returns how many were written.
+ */
+int retx_window_collect(uint8_t *buf, int max);
+
+/* Readings waiting for an acknowledgement */
+int retx_window_length(void);
+
+/* Retransmissions sent, and readings given up since boot */
+unsigned long retx_window_sent(void);
+unsigned long retx_window_abandoned(void);
+
+#endif /* RETX_WINDOW_H_ */
@@ -0,0 +1,189 @@
+#include "contiki.h"
+#include "sys/ctimer.h"
+#include "sys/rtimer.h"
+#include "lib/sensors.h"
+#include "dev/tmp102.h"
+#include "dev/adxl345.h"
+#include "node-id.h"
+#include "ssn-proto.h"
+#include "ssn-energy.h"
+#include "sensing.h"
+
+#include <stdio.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+/* Typical currents in uA: the MSP430 while active, the sensors while powered */
+#define CURRENT_CPU 1800UL
+#define CURRENT_TMP102 10UL
+#define CURRENT_ADXL345 140UL
+#define SUPPLY_VOLTAGE 3UL
+
+/* The ADXL345 is read in full resolution, 3.9 mg per LSB */
+#define ADXL345_MG(raw) ((int32_t)(raw) * 39 / 10)
+
+/* Low-pass filters in Q8: temperature, then the three axes */
+#define FILTERS 4
+static int32_t filter[FILTERS];
+static uint8_t primed = 0;
+
+static struct ctimer sense_timer;
+static struct ctimer report_timer;
+static unsigned long samples = 0;
+static unsigned long busy_ticks = 0;
+static unsigned long powered_since;
+
+/*---------------------------------------------------------------------------*/
+static void
+filter_update(uint8_t i, int16_t raw)
+{
+  if (!primed)
+  {
+    // The first raw value seeds the filter instead of ramping up from 0
+    filter[i] = (int32_t)raw << 8;
+  }
+  else
+  {
+    // y += (x - y) / 2^shift, no multiplication and no float on the MSP430
+    filter[i] += (((int32_t)raw << 8) - filter[i]) >> CLIENT_CONF_SENSE_FILTER_SHIFT;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static int16_t
+filter_output(uint8_t i)
+{
+  // Round to nearest on the way out of Q8
+  return (int16_t)((filter[i] + 128) >> 8);
+}
+
+/*---------------------------------------------------------------------------*/
+static uint16_t
+isqrt(uint32_t x)
+{
+  uint32_t root = 0;
+  uint32_t bit = 1UL << 30;
+
+  while (bit > x)
+  {
+    bit >>= 2;
+  }
+
+  while (bit != 0)
+  {
+    if (x >= root + bit)
+    {
+      x -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+    {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return root;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+sense_read(void)
+{
+  rtimer_clock_t start = RTIMER_NOW();
+
+  filter_update(0, tmp102.value(TMP102_READ));
+  filter_update(1, adxl345.value(X_AXIS));
+  filter_update(2, adxl345.value(Y_AXIS));
+  filter_update(3, adxl345.value(Z_AXIS));
+  primed = 1;
+
+  busy_ticks += (rtimer_clock_t)(RTIMER_NOW() - start);
+  samples++;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+sense_timeout(void *ptr)
+{
+  ctimer_reset(&sense_timer);
+  sense_read();
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+report_timeout(void *ptr)
+{
+  sensing_report();
+  ctimer_reset(&report_timer);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+sensing_init(void)
+{
+  SENSORS_ACTIVATE(tmp102);
+  SENSORS_ACTIVATE(adxl345);
+  powered_since = clock_seconds();
+
+  // The first sample is taken now so that a reading is available right away,
+  // the timer is armed after it so the next one comes a period later
+  sense_read();
+  ctimer_set(&sense_timer, CLIENT_CONF_SAMPLE_INTERVAL / CLIENT_CONF_SENSE_OVERSAMPLE, sense_timeout, NULL);
+
+#if SSN_CONF_ENERGY_REPORT_INTERVAL
+  ctimer_set(&report_timer, SSN_CONF_ENERGY_REPORT_INTERVAL, report_timeout, NULL);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+void
+sensing_set_interval(clock_time_t interval)
+{
+  // The filter keeps its state, only the pace of the raw reads changes
+  ctimer_set(&sense_timer, interval / CLIENT_CONF_SENSE_OVERSAMPLE, sense_timeout, NULL);
+}
+
+/*---------------------------------------------------------------------------*/
+uint8_t
+sensing_kind(uint8_t channel)
+{
+  return channel == SENSING_TEMPERATURE ? SSN_READING_TEMPERATURE : SSN_READING_ACCELERATION;
+}
+
+/*---------------------------------------------------------------------------*/
+int16_t
+sensing_value(uint8_t channel)
+{
+  int32_t x, y, z;
+  uint32_t magnitude;
+
+  if (channel == SENSING_TEMPERATURE)
+  {
+    return filter_output(0);
+  }
+
+  // The axes are filtered on their own, the magnitude is taken at decimation
+  x = ADXL345_MG(filter_output(1));
+  y = ADXL345_MG(filter_output(2));
+  z = ADXL345_MG(filter_output(3));
+  magnitude = isqrt((uint32_t)(x * x) + (uint32_t)(y * y) + (uint32_t)(z * z));
+
+  return magnitude > INT16_MAX ? INT16_MAX : (int16_t)magnitude;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+sensing_report(void)
+{
+  unsigned long cycles = samples ? (unsigned long)((uint64_t)busy_ticks * (F_CPU / RTIMER_SECOND) / samples) : 0;
+  // CPU time of the pipeline plus the sensors powered since boot, in uJ
+  uint64_t energy = (uint64_t)busy_ticks * CURRENT_CPU * SUPPLY_VOLTAGE / RTIMER_SECOND +
+                    (uint64_t)(clock_seconds() - powered_since) * (CURRENT_TMP102 + CURRENT_ADXL345) * SUPPLY_VOLTAGE;
+
+  // One line per report so the Cooja log can be parsed next to ENERGEST
+  printf("SENSE node %u samples %lu cycles %lu energy %lu uJ\n",
+         node_id, samples, cycles, (unsigned long)energy);
+}
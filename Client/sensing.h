@@ -0,0 +1,37 @@
+/*
+ * Acquisition pipeline of the Z1 on-board sensors.
+ *
+ * The TMP102 temperature sensor and the ADXL345 accelerometer are read
+ * CLIENT_CONF_SENSE_OVERSAMPLE times per sample interval. Every raw value
+ * goes through a first-order low-pass filter in Q8 fixed point, and the
+ * client decimates by reading the filter output once per sample interval.
+ * The time spent in the pipeline is measured with the rtimer to report its
+ * cost in CPU cycles and energy.
+ */
+
+#ifndef SENSING_H_
+#define SENSING_H_
+
+#include "contiki.h"
+
+/* Channels of the pipeline, one record per channel and sample */
+#define SENSING_TEMPERATURE 0 /* hundredths of a degree Celsius */
+#define SENSING_ACCELERATION 1 /* magnitude of the acceleration in mg */
+#define SENSING_CHANNELS 2
+
+/* Powers the sensors and starts oversampling */
+void sensing_init(void);
+
+/* Oversamples over a new sample interval, in clock ticks */
+void sensing_set_interval(clock_time_t interval);
+
+/* Reading kind of the records of a channel */
+uint8_t sensing_kind(uint8_t channel);
+
+/* Current filter output of a channel */
+int16_t sensing_value(uint8_t channel);
+
+/* Prints the samples taken, the cycles per sample and the pipeline energy */
+void sensing_report(void);
+
+#endif /* SENSING_H_ */
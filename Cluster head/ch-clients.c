@@ -0,0 +1,173 @@
+#include "contiki.h"
+#include "lib/memb.h"
+#include "lib/list.h"
+#include "ch-clients.h"
+#include "ssn-proto.h"
+#include "ssn-tsch.h"
+
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ipv6/uip-debug.h"
+
+MEMB(clients_memb, ch_client_t, CH_CONF_MAX_CLIENTS);
+LIST(clients_list);
+
+/*---------------------------------------------------------------------------*/
+static uint8_t
+slot_alloc(void)
+{
+  ch_client_t *client;
+  uint8_t slot;
+
+  for (slot = 0; slot < CH_CONF_MAX_CLIENTS; slot++)
+  {
+    for (client = list_head(clients_list); client != NULL; client = list_item_next(client))
+    {
+      if (client->slot == slot)
+      {
+        break;
+      }
+    }
+    if (client == NULL)
+    {
+      return slot;
+    }
+  }
+
+  return SSN_SLOT_NONE;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+slot_free(ch_client_t *client)
+{
+#if MAC_CONF_WITH_TSCH
+  if (client->slot != SSN_SLOT_NONE)
+  {
+    ssn_tsch_remove_client(client->slot);
+  }
+#endif
+  client->slot = SSN_SLOT_NONE;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ch_clients_init(void)
+{
+  memb_init(&clients_memb);
+  list_init(clients_list);
+}
+
+/*---------------------------------------------------------------------------*/
+ch_client_t *
+ch_clients_lookup(uint16_t node_id)
+{
+  ch_client_t *client;
+
+  for (client = list_head(clients_list); client != NULL; client = list_item_next(client))
+  {
+    if (client->node_id == node_id)
+    {
+      return client;
+    }
+  }
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+ch_client_t *
+ch_clients_refresh(uint16_t node_id, const uip_ipaddr_t *addr, uint8_t relayed)
+{
+  ch_client_t *client = ch_clients_lookup(node_id);
+
+  if (client == NULL)
+  {
+    client = memb_alloc(&clients_memb);
+    if (client == NULL)
+    {
+      PRINTF("Client table full, ignoring node %u\n", node_id);
+      return NULL;
+    }
+
+    memset(client, 0, sizeof(*client));
+    client->node_id = node_id;
+    client->slot = SSN_SLOT_NONE;
+    list_add(clients_list, client);
+
+    PRINTF("Client %u associated, %d clients\n", node_id, list_length(clients_list));
+  }
+
+  if (relayed || !uip_ipaddr_cmp(&client->addr, addr))
+  {
+    // Moved behind a member or rebooted with another address
+    slot_free(client);
+    client->seq_known = 0;
+  }
+  uip_ipaddr_copy(&client->addr, addr);
+  client->relayed = relayed;
+  if (!relayed && client->slot == SSN_SLOT_NONE)
+  {
+    client->slot = slot_alloc();
+#if MAC_CONF_WITH_TSCH
+    ssn_tsch_add_client(client->slot, &client->addr);
+#endif
+  }
+  client->last_seen = clock_time();
+  return client;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_clients_expire(void)
+{
+  ch_client_t *client;
+  ch_client_t *next;
+  int removed = 0;
+  clock_time_t now = clock_time();
+
+  for (client = list_head(clients_list); client != NULL; client = next)
+  {
+    next = list_item_next(client);
+    if (now - client->last_seen > CH_CONF_CLIENT_TIMEOUT)
+    {
+      PRINTF("Client %u timed out\n", client->node_id);
+      slot_free(client);
+      list_remove(clients_list, client);
+      memb_free(&clients_memb, client);
+      removed++;
+    }
+  }
+
+  return removed;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_clients_count(void)
+{
+  ch_client_t *client;
+  int n = 0;
+
+  for (client = list_head(clients_list); client != NULL; client = list_item_next(client))
+  {
+    n += !client->relayed;
+  }
+
+  return n;
+}
+
+/*---------------------------------------------------------------------------*/
+ch_client_t *
+ch_clients_head(void)
+{
+  return list_head(clients_list);
+}
+
+/*---------------------------------------------------------------------------*/
+ch_client_t *
+ch_clients_next(ch_client_t *client)
+{
+  return list_item_next(client);
+}
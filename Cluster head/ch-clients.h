@@ -0,0 +1,50 @@
+/*
+ * Association table of the clients that report to this cluster head.
+ *
+ * Entries come from a fixed MEMB pool, are refreshed by every reading
+ * received from the client and are removed after CH_CONF_CLIENT_TIMEOUT.
+ * An active head also tracks the clients whose readings a member relays,
+ * so acknowledgements of the collector find their way back. Every direct
+ * client owns a slot of the schedule of the cluster head, the lowest free
+ * one when it associates.
+ */
+
+#ifndef CH_CLIENTS_H_
+#define CH_CLIENTS_H_
+
+#include "contiki.h"
+#include "net/ipv6/uip.h"
+
+typedef struct ch_client
+{
+  struct ch_client *next; // Must be the first member
+  uip_ipaddr_t addr;
+  uint16_t node_id;
+  uint8_t relayed; // Reports through the member CH at addr
+  uint8_t slot;    // Index in the schedule of this CH, SSN_SLOT_NONE if relayed
+  uint8_t seq_known;
+  uint16_t last_seq; // Highest reading sequence number received directly
+  clock_time_t last_seen;
+} ch_client_t;
+
+void ch_clients_init(void);
+
+/* Returns the client with this node id, or NULL if it is not associated */
+ch_client_t *ch_clients_lookup(uint16_t node_id);
+
+/*
+ * Associates the client if needed and marks it alive, addr is the member
+ * CH if relayed is set. Returns NULL if the pool is full.
+ */
+ch_client_t *ch_clients_refresh(uint16_t node_id, const uip_ipaddr_t *addr, uint8_t relayed);
+
+/* Removes the clients not heard for CH_CONF_CLIENT_TIMEOUT, returns how many */
+int ch_clients_expire(void);
+
+/* Clients attached to this node, without the relayed ones */
+int ch_clients_count(void);
+
+ch_client_t *ch_clients_head(void);
+ch_client_t *ch_clients_next(ch_client_t *client);
+
+#endif /* CH_CLIENTS_H_ */
@@ -0,0 +1,50 @@
+#include "contiki.h"
+#include "ch-dedup.h"
+
+#include <string.h>
+
+typedef struct dedup_entry
+{
+  uint16_t node_id;
+  uint16_t seq;
+  clock_time_t seen;
+} dedup_entry_t;
+
+static dedup_entry_t cache[CH_CONF_DEDUP_CACHE_SIZE];
+static unsigned long dropped = 0;
+
+/*---------------------------------------------------------------------------*/
+void
+ch_dedup_init(void)
+{
+  memset(cache, 0, sizeof(cache));
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_dedup_check(uint16_t node_id, uint16_t seq)
+{
+  clock_time_t now = clock_time();
+  // Consecutive readings of a node land in consecutive slots
+  dedup_entry_t *e = &cache[(uint16_t)(node_id * 7 + seq) % CH_CONF_DEDUP_CACHE_SIZE];
+
+  if (e->seen != 0 && e->node_id == node_id && e->seq == seq &&
+      now - e->seen < CH_CONF_DEDUP_LIFETIME)
+  {
+    dropped++;
+    return 1;
+  }
+
+  e->node_id = node_id;
+  e->seq = seq;
+  // 0 marks an empty slot
+  e->seen = now ? now : 1;
+  return 0;
+}
+
+/*---------------------------------------------------------------------------*/
+unsigned long
+ch_dedup_dropped(void)
+{
+  return dropped;
+}
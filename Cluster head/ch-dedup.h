@@ -0,0 +1,22 @@
+/*
+ * Duplicate suppression cache of the readings seen by this cluster head.
+ *
+ * A direct-mapped cache keyed by (source node, sequence number). An entry
+ * older than CH_CONF_DEDUP_LIFETIME no longer matches, and a colliding
+ * reading simply takes its slot.
+ */
+
+#ifndef CH_DEDUP_H_
+#define CH_DEDUP_H_
+
+#include "contiki.h"
+
+void ch_dedup_init(void);
+
+/* Returns 1 if the reading was seen recently, otherwise records it and returns 0 */
+int ch_dedup_check(uint16_t node_id, uint16_t seq);
+
+/* Number of duplicates dropped since boot */
+unsigned long ch_dedup_dropped(void);
+
+#endif /* CH_DEDUP_H_ */
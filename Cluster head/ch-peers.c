@@ -0,0 +1,158 @@
+#include "contiki.h"
+#include "lib/memb.h"
+#include "lib/list.h"
+#include "ch-peers.h"
+
+#include <string.h>
+
+#define DEBUG DEBUG_PRINT
+#include "net/ipv6/uip-debug.h"
+
+/* Number of hash buckets, a power of two */
+#define CH_PEERS_BUCKETS 8
+
+MEMB(peers_memb, ch_peer_t, CH_CONF_MAX_PEERS);
+LIST(peers_list);
+
+static ch_peer_t *buckets[CH_PEERS_BUCKETS];
+
+/*---------------------------------------------------------------------------*/
+static uint8_t
+bucket_of(const uip_ipaddr_t *addr)
+{
+  // The interface identifier ends with the node id, which spreads well
+  return (addr->u8[14] ^ addr->u8[15]) & (CH_PEERS_BUCKETS - 1);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ch_peers_init(void)
+{
+  memb_init(&peers_memb);
+  list_init(peers_list);
+  memset(buckets, 0, sizeof(buckets));
+}
+
+/*---------------------------------------------------------------------------*/
+ch_peer_t *
+ch_peers_lookup(const uip_ipaddr_t *addr)
+{
+  ch_peer_t *peer;
+
+  for (peer = buckets[bucket_of(addr)]; peer != NULL; peer = peer->bucket)
+  {
+    if (uip_ipaddr_cmp(&peer->addr, addr))
+    {
+      return peer;
+    }
+  }
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+ch_peer_t *
+ch_peers_refresh(const uip_ipaddr_t *addr, uint16_t node_id)
+{
+  ch_peer_t *peer = ch_peers_lookup(addr);
+
+  if (peer == NULL)
+  {
+    peer = memb_alloc(&peers_memb);
+    if (peer == NULL)
+    {
+      PRINTF("Peer table full, ignoring node %u\n", node_id);
+      return NULL;
+    }
+
+    memset(peer, 0, sizeof(*peer));
+    uip_ipaddr_copy(&peer->addr, addr);
+    peer->bucket = buckets[bucket_of(addr)];
+    buckets[bucket_of(addr)] = peer;
+    list_add(peers_list, peer);
+
+    PRINTF("New peer cluster head %u, %d peers\n", node_id, list_length(peers_list));
+  }
+
+  peer->node_id = node_id;
+  peer->last_seen = clock_time();
+  return peer;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ch_peers_link_update(ch_peer_t *peer, int8_t rssi)
+{
+  if (peer->rssi == 0)
+  {
+    peer->rssi = rssi;
+  }
+  else
+  {
+    // Moving average with a weight of 1/4 for the new sample
+    peer->rssi = (3 * peer->rssi + rssi) / 4;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+remove_peer(ch_peer_t *peer)
+{
+  ch_peer_t **p;
+
+  for (p = &buckets[bucket_of(&peer->addr)]; *p != NULL; p = &(*p)->bucket)
+  {
+    if (*p == peer)
+    {
+      *p = peer->bucket;
+      break;
+    }
+  }
+
+  list_remove(peers_list, peer);
+  memb_free(&peers_memb, peer);
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_peers_expire(void)
+{
+  ch_peer_t *peer;
+  ch_peer_t *next;
+  int removed = 0;
+  clock_time_t now = clock_time();
+
+  for (peer = list_head(peers_list); peer != NULL; peer = next)
+  {
+    next = list_item_next(peer);
+    if (now - peer->last_seen > CH_CONF_PEER_TIMEOUT)
+    {
+      PRINTF("Peer cluster head %u timed out\n", peer->node_id);
+      remove_peer(peer);
+      removed++;
+    }
+  }
+
+  return removed;
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_peers_count(void)
+{
+  return list_length(peers_list);
+}
+
+/*---------------------------------------------------------------------------*/
+ch_peer_t *
+ch_peers_head(void)
+{
+  return list_head(peers_list);
+}
+
+/*---------------------------------------------------------------------------*/
+ch_peer_t *
+ch_peers_next(ch_peer_t *peer)
+{
+  return list_item_next(peer);
+}
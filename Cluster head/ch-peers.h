@@ -0,0 +1,52 @@
+/*
+ * Membership table of the peer cluster heads.
+ *
+ * Entries come from a fixed MEMB pool and are refreshed by every heartbeat
+ * or bid received from a peer. A peer that stays silent for
+ * CH_CONF_PEER_TIMEOUT is removed by ch_peers_expire(). Lookups by address
+ * go through a small hash table, so they do not depend on the table size.
+ */
+
+#ifndef CH_PEERS_H_
+#define CH_PEERS_H_
+
+#include "contiki.h"
+#include "net/ipv6/uip.h"
+
+typedef struct ch_peer
+{
+  struct ch_peer *next;   // Next peer in the live list, must be the first member
+  struct ch_peer *bucket; // Next peer in the same hash bucket
+  uip_ipaddr_t addr;
+  uint16_t node_id;
+  clock_time_t last_seen;
+  uint16_t bid_round; // Round of the last bid received from this peer
+  uint16_t bid;
+  uint8_t is_head;  // The peer won the last round
+  uint8_t clients;  // Clients attached to the peer, from its heartbeat
+  uint16_t load;    // Readings forwarded per minute, from its heartbeat
+  int16_t rssi;     // Moving average of the RSSI of the peer's messages
+} ch_peer_t;
+
+void ch_peers_init(void);
+
+/* Returns the peer with this address, or NULL if it is not in the table */
+ch_peer_t *ch_peers_lookup(const uip_ipaddr_t *addr);
+
+/* Adds the peer if needed and marks it alive. Returns NULL if the pool is full */
+ch_peer_t *ch_peers_refresh(const uip_ipaddr_t *addr, uint16_t node_id);
+
+/* Folds an RSSI sample of a message from the peer into its link estimate */
+void ch_peers_link_update(ch_peer_t *peer, int8_t rssi);
+
+/* Removes the peers not heard for CH_CONF_PEER_TIMEOUT, returns how many */
+int ch_peers_expire(void);
+
+/* Number of live peers, this node excluded */
+int ch_peers_count(void);
+
+/* Iteration over the live peers */
+ch_peer_t *ch_peers_head(void);
+ch_peer_t *ch_peers_next(ch_peer_t *peer);
+
+#endif /* CH_PEERS_H_ */
@@ -0,0 +1,191 @@
+#include "contiki.h"
+#include "ch-queue.h"
+
+#include <string.h>
+
+#if CH_CONF_UPLINK_QUEUE_CFS
+#include "cfs/cfs.h"
+#endif
+
+#define DEBUG DEBUG_PRINT
+#include "net/ipv6/uip-debug.h"
+
+static ch_queue_frame_t ring[CH_CONF_UPLINK_QUEUE_LEN];
+static uint8_t ring_head = 0;
+static uint8_t ring_count = 0;
+static unsigned long dropped = 0;
+
+#if CH_CONF_UPLINK_QUEUE_CFS
+#define SPILL_FILE "uplq"
+
+/* Frames are stored with a fixed size, so frame i is at offset i * size */
+static uint16_t spill_read = 0;
+static uint16_t spill_write = 0;
+
+/*---------------------------------------------------------------------------*/
+static int
+spill_push(const ch_queue_frame_t *frame)
+{
+  int fd;
+  int written;
+
+  if (spill_write >= CH_CONF_UPLINK_QUEUE_CFS_FRAMES)
+  {
+    return 0;
+  }
+
+  fd = cfs_open(SPILL_FILE, CFS_WRITE | CFS_APPEND);
+  if (fd < 0)
+  {
+    return 0;
+  }
+  written = cfs_write(fd, frame, sizeof(*frame));
+  cfs_close(fd);
+
+  if (written != sizeof(*frame))
+  {
+    return 0;
+  }
+
+  spill_write++;
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+spill_refill(void)
+{
+  int fd;
+
+  // Bring the oldest spilled frames back while the ring has room
+  fd = cfs_open(SPILL_FILE, CFS_READ);
+  if (fd >= 0)
+  {
+    cfs_seek(fd, (long)spill_read * sizeof(ch_queue_frame_t), CFS_SEEK_SET);
+    while (spill_read < spill_write && ring_count < CH_CONF_UPLINK_QUEUE_LEN)
+    {
+      ch_queue_frame_t *frame = &ring[(ring_head + ring_count) % CH_CONF_UPLINK_QUEUE_LEN];
+      if (cfs_read(fd, frame, sizeof(*frame)) != sizeof(*frame))
+      {
+        PRINTF("Uplink queue: unreadable spill file, %u frames lost\n", spill_write - spill_read);
+        dropped += spill_write - spill_read;
+        spill_read = spill_write;
+        break;
+      }
+      ring_count++;
+      spill_read++;
+    }
+    cfs_close(fd);
+  }
+
+  if (spill_read == spill_write)
+  {
+    cfs_remove(SPILL_FILE);
+    spill_read = 0;
+    spill_write = 0;
+  }
+}
+#endif /* CH_CONF_UPLINK_QUEUE_CFS */
+
+/*---------------------------------------------------------------------------*/
+void
+ch_queue_init(void)
+{
+  ring_head = 0;
+  ring_count = 0;
+#if CH_CONF_UPLINK_QUEUE_CFS
+  // Frames left by a previous boot have lost their timing, start afresh
+  cfs_remove(SPILL_FILE);
+  spill_read = 0;
+  spill_write = 0;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_queue_push(const uint8_t *data, uint8_t len)
+{
+  ch_queue_frame_t *frame;
+
+  if (len > CH_QUEUE_FRAME_LEN)
+  {
+    return 0;
+  }
+
+#if CH_CONF_UPLINK_QUEUE_CFS
+  if (ring_count == CH_CONF_UPLINK_QUEUE_LEN || spill_write > 0)
+  {
+    // Once frames are in flash, later ones follow them there to keep the order
+    static ch_queue_frame_t spilled;
+
+    spilled.queued = clock_time();
+    spilled.len = len;
+    memcpy(spilled.data, data, len);
+    if (spill_push(&spilled))
+    {
+      return 1;
+    }
+
+    dropped++;
+    PRINTF("Uplink queue full, %lu frames dropped\n", dropped);
+    return 0;
+  }
+#else
+  if (ring_count == CH_CONF_UPLINK_QUEUE_LEN)
+  {
+    dropped++;
+    PRINTF("Uplink queue full, %lu frames dropped\n", dropped);
+    return 0;
+  }
+#endif
+
+  frame = &ring[(ring_head + ring_count) % CH_CONF_UPLINK_QUEUE_LEN];
+  frame->queued = clock_time();
+  frame->len = len;
+  memcpy(frame->data, data, len);
+  ring_count++;
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+ch_queue_frame_t *
+ch_queue_front(void)
+{
+#if CH_CONF_UPLINK_QUEUE_CFS
+  if (ring_count == 0 && spill_write > 0)
+  {
+    spill_refill();
+  }
+#endif
+
+  return ring_count > 0 ? &ring[ring_head] : NULL;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ch_queue_pop(void)
+{
+  if (ring_count > 0)
+  {
+    ring_head = (ring_head + 1) % CH_CONF_UPLINK_QUEUE_LEN;
+    ring_count--;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+int
+ch_queue_length(void)
+{
+#if CH_CONF_UPLINK_QUEUE_CFS
+  return ring_count + (spill_write - spill_read);
+#else
+  return ring_count;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+unsigned long
+ch_queue_dropped(void)
+{
+  return dropped;
+}
@@ -0,0 +1,48 @@
+/*
+ * Store-and-forward queue of the batches waiting for the route to the
+ * border router.
+ *
+ * Batches are kept in a RAM ring of CH_CONF_UPLINK_QUEUE_LEN frames. With
+ * CH_CONF_UPLINK_QUEUE_CFS, the batches that do not fit in the ring spill
+ * to a Coffee file and come back in order once the ring has drained.
+ */
+
+#ifndef CH_QUEUE_H_
+#define CH_QUEUE_H_
+
+#include "contiki.h"
+#include "ssn-proto.h"
+
+#define CH_QUEUE_FRAME_LEN SSN_BATCH_LEN(CH_CONF_BATCH_SIZE)
+
+#if CH_CONF_UPLINK_QUEUE_CFS
+#define CH_QUEUE_CAPACITY (CH_CONF_UPLINK_QUEUE_LEN + CH_CONF_UPLINK_QUEUE_CFS_FRAMES)
+#else
+#define CH_QUEUE_CAPACITY CH_CONF_UPLINK_QUEUE_LEN
+#endif
+
+typedef struct ch_queue_frame
+{
+  clock_time_t queued; // When the frame entered the queue
+  uint8_t len;
+  uint8_t data[CH_QUEUE_FRAME_LEN];
+} ch_queue_frame_t;
+
+void ch_queue_init(void);
+
+/* Appends a frame, returns 0 and counts a drop if the queue is full */
+int ch_queue_push(const uint8_t *data, uint8_t len);
+
+/* Oldest frame of the queue, or NULL if it is empty */
+ch_queue_frame_t *ch_queue_front(void);
+
+/* Removes the oldest frame */
+void ch_queue_pop(void);
+
+/* Number of frames in the queue, flash included */
+int ch_queue_length(void);
+
+/* Number of frames dropped because the queue was full */
+unsigned long ch_queue_dropped(void);
+
+#endif /* CH_QUEUE_H_ */
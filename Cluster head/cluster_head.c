@@ -5,13 +5,20 @@
 #include "net/routing/rpl-classic/rpl.h"
 
 #include "net/netstack.h"
+#include "net/routing/routing.h"
+#include "node-id.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
-#include <math.h>
 
 #include "cc2420.h"
+#include "ssn-proto.h"
+#include "ch-peers.h"
+#include "ch-clients.h"
+#include "ch-queue.h"
+#include "ch-dedup.h"
+#include "ssn-energy.h"
+#include "ssn-tsch.h"
 
 #define DEBUG DEBUG_PRINT
 #include "net/ipv6/uip-debug.h"
@@ -27,7 +34,12 @@
 #define MCAST_SINK_UDP_PORT 3001
 #define MCAST_SINK_UDP_PORT_CH 3002
 
-#define MAX_PAYLOAD_LEN 5
+/* Readings are batched into a buffer that still fits a single 802.15.4 frame */
+#define BATCH_BUF_LEN SSN_BATCH_LEN(CH_CONF_BATCH_SIZE)
+
+#if CH_CONF_BATCH_SIZE > SSN_BATCH_MAX
+#error "CH_CONF_BATCH_SIZE must fit a single batch"
+#endif
 
 static struct uip_udp_conn *client_conn;
 static struct uip_udp_conn *border_conn;
@@ -39,22 +51,69 @@ static struct uip_udp_conn *ch_conn;
 static uip_ipaddr_t border_ipaddr;
 static uip_ipaddr_t ch_ipaddr;
 
-static char random_number_string[MAX_PAYLOAD_LEN];
-
-static int random_number;
 static int ch_can_send = 1;
-static int first_iteration = 0;
-static int num_of_ch = 0;
-static int count = 0;
-static int tot = 0;
+static uint16_t forwarded = 0;
+static uint16_t load = 0;
+
+static uint8_t batch_buf[BATCH_BUF_LEN];
+static clock_time_t batch_arrival[CH_CONF_BATCH_SIZE];
+static int batch_readings = 0;
+static uint16_t batch_seq = 0;
+static struct ctimer batch_timer;
+
+static struct ctimer uplink_timer;
+static uint8_t uplink_congested = 0;
+static clock_time_t backoff_sent;
+
+/* Clients waiting for a beacon in reply to their solicitation */
+static uip_ipaddr_t solicit_pending[CH_CONF_SOLICIT_PENDING];
+static uint8_t solicit_count = 0;
+static struct ctimer solicit_timer;
 
-typedef struct ch_list
+/* The RSSI echo only changes in its sequence number and RSSI byte */
+static uint8_t echo_buf[SSN_RSSI_ECHO_LEN];
+
+static uint16_t election_seq = 0;
+static struct etimer election_et;
+
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_AVERAGE
+typedef enum
 {
-  int val;
-  uip_ipaddr_t addr;
-} ch_list_t;
+  ELECTION_IDLE,
+  ELECTION_BIDDING
+} election_state_t;
 
-static ch_list_t *ch_list_struct = NULL;
+static election_state_t election_state = ELECTION_IDLE;
+static struct ctimer election_timer;
+static struct etimer heartbeat_et;
+
+static int random_number;
+static int num_of_bids = 0;
+static uint16_t last_head_round = 0;
+static uint8_t has_been_head = 0;
+#endif
+
+/* Control-plane traffic sent by this node, to compare the election modes */
+static unsigned long ctrl_msgs = 0;
+static unsigned long ctrl_bytes = 0;
+
+/* Readings received from and lost by the direct clients, for the delivery ratio of the cluster */
+static unsigned long link_rx = 0;
+static unsigned long link_lost = 0;
+
+/* Sample interval pushed to the clients in seconds, and the load it is controlled on */
+static uint16_t client_interval = CH_CONF_SAMPLE_INTERVAL;
+static uint16_t rate_rx = 0;
+static uint16_t rate_avg = 0; // Readings per minute from the direct clients
+static uint8_t rate_seeded = 0;
+static clock_time_t rate_changed = 0;
+static struct ctimer rate_timer;
+
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_HASH
+static struct uip_udp_conn *beacon_conn;
+static struct ctimer beacon_timer;
+static int16_t best_beacon_rssi;
+#endif
 
 PROCESS(udp_server_process, "UDP server process");
 AUTOSTART_PROCESSES(&udp_server_process);
@@ -72,15 +131,24 @@ prepare_mcast(int port)
 
 /*---------------------------------------------------------------------------*/
 static void
-multicast_send(char *message, struct uip_udp_conn *connection)
+multicast_send(uint8_t type, const uint8_t *body, int body_len, struct uip_udp_conn *connection)
 {
-  if (strlen(message) <= MAX_PAYLOAD_LEN)
+  uint8_t buf[SSN_HEARTBEAT_LEN];
+
+  if (body_len <= (int)sizeof(buf) - SSN_HDR_LEN)
   {
-    PRINTF("Sending multicast data '%s' to ", message);
+    PRINTF("Sending multicast message %u to ", type);
     PRINT6ADDR(&connection->ripaddr);
     PRINTF("\n");
 
-    uip_udp_packet_send(connection, message, strlen(message));
+    ssn_hdr_write(buf, type, node_id, election_seq);
+    if (body_len > 0)
+    {
+      memcpy(&buf[SSN_HDR_LEN], body, body_len);
+    }
+    uip_udp_packet_send(connection, buf, SSN_HDR_LEN + body_len);
+    ctrl_msgs++;
+    ctrl_bytes += SSN_HDR_LEN + body_len;
   }
   else
   {
@@ -90,12 +158,147 @@ multicast_send(char *message, struct uip_udp_conn *connection)
 
 /*---------------------------------------------------------------------------*/
 static void
-send_packet(void *ptr, char *buf, uip_ipaddr_t dest_ipaddr, struct uip_udp_conn *dest_conn, int rem_port)
+send_packet(void *ptr, const uint8_t *buf, int len, const uip_ipaddr_t *dest_ipaddr, struct uip_udp_conn *dest_conn, int rem_port)
 {
-  PRINTF("Sending data '%s'  ", buf);
-  PRINT6ADDR(&dest_ipaddr);
+#if CH_CONF_TRACE_DATA
+  PRINTF("Sending message %u (%d bytes) to ", buf[1], len);
+  PRINT6ADDR(dest_ipaddr);
   PRINTF("\n");
-  uip_udp_packet_sendto(dest_conn, buf, strlen(buf), &dest_ipaddr, UIP_HTONS(rem_port));
+#endif
+  uip_udp_packet_sendto(dest_conn, buf, len, dest_ipaddr, UIP_HTONS(rem_port));
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+backoff_update(void)
+{
+  int len = ch_queue_length();
+  uint8_t shift;
+
+  if (!uplink_congested && len >= CH_QUEUE_CAPACITY * 3 / 4)
+  {
+    uplink_congested = 1;
+    shift = CH_CONF_BACKOFF_SHIFT;
+  }
+  else if (uplink_congested && len <= CH_QUEUE_CAPACITY / 4)
+  {
+    uplink_congested = 0;
+    shift = 0;
+  }
+  else if (uplink_congested && clock_time() - backoff_sent >= CH_CONF_BACKOFF_REFRESH)
+  {
+    // Repeat the request while congested, clients forget it after a while
+    shift = CH_CONF_BACKOFF_SHIFT;
+  }
+  else
+  {
+    return;
+  }
+
+  PRINTF("Uplink queue at %d frames, asking clients for backoff %u\n", len, shift);
+  backoff_sent = clock_time();
+  multicast_send(SSN_MSG_BACKOFF, &shift, 1, mcast_conn);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+uplink_drain(void *ptr)
+{
+  int i;
+  uint8_t *age;
+  uint32_t queued;
+  ch_queue_frame_t *frame;
+
+  // Paced flush: one batch per tick while the border router is reachable
+  if (NETSTACK_ROUTING.node_is_reachable() && (frame = ch_queue_front()) != NULL)
+  {
+    queued = (clock_time() - frame->queued) * 10 / CLOCK_SECOND;
+    age = &frame->data[SSN_BATCH_LEN(0) + SSN_RECORD_AGE_OFFSET];
+    for (i = 0; i < frame->data[SSN_HDR_LEN]; i++, age += SSN_RECORD_LEN)
+    {
+      ssn_put_u16(age, ssn_age_add(ssn_get_u16(age), queued));
+    }
+
+    send_packet(NULL, frame->data, frame->len, &border_ipaddr, border_conn, UDP_BORDER_PORT);
+    ch_queue_pop();
+  }
+
+  backoff_update();
+
+  if (ch_queue_length() > 0)
+  {
+    ctimer_set(&uplink_timer, CH_CONF_UPLINK_DRAIN_INTERVAL, uplink_drain, NULL);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+uplink_send(const uint8_t *frame, int len)
+{
+  if (ch_queue_length() == 0 && NETSTACK_ROUTING.node_is_reachable())
+  {
+    send_packet(NULL, frame, len, &border_ipaddr, border_conn, UDP_BORDER_PORT);
+    return;
+  }
+
+  // No route to the border router, or older batches are still waiting
+  PRINTF("Border router unreachable, queueing the batch\n");
+  ch_queue_push(frame, len);
+  backoff_update();
+
+  if (ctimer_expired(&uplink_timer))
+  {
+    ctimer_set(&uplink_timer, CH_CONF_UPLINK_DRAIN_INTERVAL, uplink_drain, NULL);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+batch_flush(void *ptr)
+{
+  int i;
+  uint8_t *age;
+  clock_time_t now = clock_time();
+
+  ctimer_stop(&batch_timer);
+
+  if (batch_readings > 0)
+  {
+    // Account for the time every reading spent waiting in the batch
+    age = &batch_buf[SSN_BATCH_LEN(0) + SSN_RECORD_AGE_OFFSET];
+    for (i = 0; i < batch_readings; i++, age += SSN_RECORD_LEN)
+    {
+      ssn_put_u16(age, ssn_age_add(ssn_get_u16(age), (now - batch_arrival[i]) * 10 / CLOCK_SECOND));
+    }
+
+    ssn_hdr_write(batch_buf, SSN_MSG_BATCH, node_id, batch_seq++);
+    batch_buf[SSN_HDR_LEN] = batch_readings;
+
+    PRINTF("Flushing batch of %d readings\n", batch_readings);
+    uplink_send(batch_buf, SSN_BATCH_LEN(batch_readings));
+  }
+
+  batch_readings = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+batch_add(const uint8_t *record)
+{
+  // The record is already encoded, it is copied as is
+  memcpy(&batch_buf[SSN_BATCH_LEN(batch_readings)], record, SSN_RECORD_LEN);
+  batch_arrival[batch_readings] = clock_time();
+  batch_readings++;
+
+  if (batch_readings >= CH_CONF_BATCH_SIZE)
+  {
+    batch_flush(NULL);
+  }
+  else if (batch_readings == 1)
+  {
+    // The deadline starts with the oldest reading in the batch
+    ctimer_set(&batch_timer, CH_CONF_BATCH_FLUSH_INTERVAL, batch_flush, NULL);
+  }
 }
 
 /*---------------------------------------------------------------------------*/
@@ -128,129 +331,705 @@ join_mcast_group_ch(void)
 }
 
 /*---------------------------------------------------------------------------*/
-static signed char
-calculate_RSSI(uip_ipaddr_t originator_ipaddr)
+static void
+solicit_reply(void *ptr)
+{
+  uint8_t i;
+  uint8_t beacon[SSN_HDR_LEN];
+
+  ssn_hdr_write(beacon, SSN_MSG_BEACON, node_id, election_seq);
+  for (i = 0; i < solicit_count; i++)
+  {
+    send_packet(NULL, beacon, sizeof(beacon), &solicit_pending[i], client_conn, MCAST_SINK_UDP_PORT);
+    ctrl_msgs++;
+    ctrl_bytes += sizeof(beacon);
+  }
+  solicit_count = 0;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+solicit_received(const uip_ipaddr_t *addr)
 {
-  static signed char rss;
-  rss = cc2420_last_rssi;
+  uint8_t i;
 
-  PRINTF("RSSI of Last Packet Received is %d dBm from ", rss);
-  PRINT6ADDR(&originator_ipaddr);
+  if (!ch_can_send)
+  {
+    // Only the active heads answer
+    return;
+  }
+
+  for (i = 0; i < solicit_count; i++)
+  {
+    if (uip_ipaddr_cmp(&solicit_pending[i], addr))
+    {
+      return;
+    }
+  }
+
+  if (solicit_count < CH_CONF_SOLICIT_PENDING)
+  {
+    uip_ipaddr_copy(&solicit_pending[solicit_count++], addr);
+  }
+
+  if (solicit_count == 1)
+  {
+    // Jitter keeps the replies of the heads from colliding
+    ctimer_set(&solicit_timer, rand() % CH_CONF_SOLICIT_JITTER + 1, solicit_reply, NULL);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+link_account(ch_client_t *client, uint16_t seq)
+{
+  int16_t gap = seq - client->last_seq;
+
+  if (client->seq_known && gap <= 0 && gap > -256)
+  {
+    // Sent again after a missed echo, already counted
+    return;
+  }
+
+  // A gap in the sequence numbers is a frame lost on the way, mostly in a
+  // collision. Far behind, the client has rebooted.
+  if (client->seq_known && gap > 0)
+  {
+    link_lost += gap - 1;
+  }
+  link_rx++;
+  client->last_seq = seq;
+  client->seq_known = 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static uint8_t
+echo_slot(const ch_client_t *client)
+{
+  if (client == NULL)
+  {
+    return SSN_SLOT_NONE;
+  }
+#if MAC_CONF_WITH_TSCH
+  return client->slot;
+#elif CH_CONF_SLOT_ASSIGNMENT
+  return client->slot < SSN_SLOT_WINDOWS ? client->slot : SSN_SLOT_NONE;
+#else
+  return SSN_SLOT_NONE;
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+static uint16_t
+slot_delay(uint8_t slot)
+{
+  // The cycle starts at boot, only the phase of the windows matters
+  clock_time_t cycle = (clock_time_t)SSN_SLOT_CYCLE_MS * CLOCK_SECOND / 1000;
+  uint16_t phase = (clock_time() % cycle) * 1000 / CLOCK_SECOND;
+
+  if (slot >= SSN_SLOT_WINDOWS)
+  {
+    return 0;
+  }
+
+  return (slot * SSN_SLOT_WINDOW_MS + SSN_SLOT_CYCLE_MS - phase) % SSN_SLOT_CYCLE_MS;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+rate_update(void *ptr)
+{
+  uint32_t incoming = (uint32_t)rate_rx * 60 * CLOCK_SECOND / CH_CONF_RATE_PERIOD;
+  uint32_t next = client_interval;
+
+  ctimer_reset(&rate_timer);
+  rate_rx = 0;
+  if (rate_seeded)
+  {
+    rate_avg = (3 * (uint32_t)rate_avg + incoming) / 4;
+  }
+  else
+  {
+    // Start from the first measurement rather than ramp up from 0
+    rate_avg = incoming;
+    rate_seeded = ch_clients_count() > 0;
+  }
+
+  if (ch_clients_count() == 0)
+  {
+    // Nobody to control, the next clients start from the nominal rate
+    next = CH_CONF_SAMPLE_INTERVAL;
+    rate_seeded = 0;
+  }
+  else if (clock_time() - rate_changed < CH_CONF_RATE_HOLD)
+  {
+    // The clients take a new interval with their next report: until they all did,
+    // the load still shows the old one
+  }
+  else if (ch_queue_length() > 0)
+  {
+    // The uplink is backing up, slow down before the queue overflows
+    next = (uint32_t)client_interval * 2;
+  }
+  else if (rate_avg * 4 > CH_CONF_TARGET_LOAD * 5 || rate_avg * 5 < CH_CONF_TARGET_LOAD * 4)
+  {
+    // Out of a 20% band around the target: the load goes with the inverse of the interval,
+    // a step is at most a factor of two since the clients follow one report later
+    next = (uint32_t)client_interval * rate_avg / CH_CONF_TARGET_LOAD;
+    if (next < client_interval / 2)
+    {
+      next = client_interval / 2;
+    }
+    else if (next > (uint32_t)client_interval * 2)
+    {
+      next = (uint32_t)client_interval * 2;
+    }
+  }
+
+  if (next < CH_CONF_SAMPLE_INTERVAL_MIN)
+  {
+    next = CH_CONF_SAMPLE_INTERVAL_MIN;
+  }
+  else if (next > CH_CONF_SAMPLE_INTERVAL_MAX)
+  {
+    next = CH_CONF_SAMPLE_INTERVAL_MAX;
+  }
+
+  if (next != client_interval)
+  {
+    PRINTF("Load %u readings/min, client sample interval %u s -> %lu s\n", rate_avg, client_interval, (unsigned long)next);
+    client_interval = next;
+    rate_changed = clock_time();
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+data_received(const uint8_t *appdata, int len, const ssn_hdr_t *hdr)
+{
+  // Everything the replies need is taken before a send reuses uip_buf
+  int from_client = (uip_udp_conn == client_conn);
+  signed char rss = cc2420_last_rssi;
+  uip_ipaddr_t src_ipaddr;
+  ch_client_t *client = NULL;
+  uint8_t frame[SSN_BATCH_LEN(SSN_BATCH_MAX)];
+  const uint8_t *record;
+  int count;
+  int fresh = 0;
+  int i;
+
+  if (hdr->type == SSN_MSG_DATA)
+  {
+    len = SSN_DATA_LEN;
+    count = 1;
+  }
+  else
+  {
+    count = appdata[SSN_HDR_LEN];
+    if (count == 0 || count > SSN_BATCH_MAX || len < SSN_BATCH_LEN(count))
+    {
+      PRINTF("Dropping a malformed batch of node %u\n", hdr->node_id);
+      return;
+    }
+    len = SSN_BATCH_LEN(count);
+  }
+
+  // A flush of the uplink batch reuses uip_buf, the records are read from a copy
+  memcpy(frame, appdata, len);
+  record = (hdr->type == SSN_MSG_DATA) ? &frame[SSN_DATA_RECORD_OFFSET] : &frame[SSN_BATCH_LEN(0)];
+
+#if CH_CONF_TRACE_DATA
+  PRINTF("DATA recv node %u seq %u (%d readings) RSSI %d from ", hdr->node_id, hdr->seq, count, rss);
+  PRINT6ADDR(&UIP_IP_BUF->srcipaddr);
   PRINTF("\n");
+#endif
+
+  uip_ipaddr_copy(&src_ipaddr, &UIP_IP_BUF->srcipaddr);
+  if (from_client)
+  {
+    client = ch_clients_refresh(hdr->node_id, &src_ipaddr, 0);
+    rate_rx += count;
+  }
+  else if (ch_can_send)
+  {
+    // Relayed by a member, acknowledgements for this client go back through it
+    ch_clients_refresh(hdr->node_id, &src_ipaddr, 1);
+  }
+
+  for (i = 0; i < count; i++, record += SSN_RECORD_LEN)
+  {
+    if (client != NULL && !(record[4] & SSN_KIND_RETX))
+    {
+      link_account(client, ssn_get_u16(&record[2]));
+    }
 
-  return rss;
+    if (!(record[4] & SSN_KIND_RETX) && ch_dedup_check(ssn_get_u16(&record[0]), ssn_get_u16(&record[2])))
+    {
+      // Already forwarded: a copy relayed by a peer or sent to a failed-over head.
+      // Retransmissions asked by the collector always go through.
+      PRINTF("Dropping duplicate seq %u of node %u (%lu so far)\n",
+             ssn_get_u16(&record[2]), ssn_get_u16(&record[0]), ch_dedup_dropped());
+    }
+    else if (ch_can_send || uip_is_addr_unspecified(&ch_ipaddr))
+    {
+      // Batch data towards the border router, also when no active head is known
+      forwarded++;
+      batch_add(record);
+    }
+    else
+    {
+      fresh++;
+    }
+  }
+
+  if (fresh > 0)
+  {
+    // Redirect the received frame to an active CH as it is, the head drops the duplicates
+    send_packet(NULL, frame, len, &ch_ipaddr, ch2ch_conn, UDP_CH2CH_PORT);
+  }
+
+  if (from_client)
+  {
+    // Send RSSI to client to regulate transmission power
+    ssn_put_u16(&echo_buf[4], hdr->seq);
+    echo_buf[SSN_HDR_LEN] = (uint8_t)rss;
+    // The echo also tells the client its slot in our schedule and when its window opens
+    echo_buf[SSN_HDR_LEN + 1] = echo_slot(client);
+    ssn_put_u16(&echo_buf[SSN_HDR_LEN + 2], slot_delay(echo_buf[SSN_HDR_LEN + 1]));
+    // And the sample interval that keeps our load near the target
+    ssn_put_u16(&echo_buf[SSN_HDR_LEN + 4], client_interval);
+    send_packet(NULL, echo_buf, sizeof(echo_buf), &src_ipaddr, client_conn, UDP_CLIENT_LISTENING_PORT);
+  }
 }
 
 /*---------------------------------------------------------------------------*/
+static void
+sack_received(const uint8_t *appdata, int len)
+{
+  uint8_t sack[SSN_SACK_LEN(SSN_SACK_MAX)];
+  uint8_t reply[SSN_SACK_LEN(1)];
+  int from_border = (uip_udp_conn == border_conn);
+  int count = appdata[SSN_HDR_LEN];
+  const uint8_t *entry;
+  ch_client_t *client;
+  int i;
+
+  if (count > SSN_SACK_MAX || len < SSN_SACK_LEN(count))
+  {
+    PRINTF("Dropping a malformed SACK\n");
+    return;
+  }
+
+  // Relaying reuses uip_buf, the entries are read from a copy
+  memcpy(sack, appdata, SSN_SACK_LEN(count));
+  entry = &sack[SSN_SACK_LEN(0)];
+
+  for (i = 0; i < count; i++, entry += SSN_SACK_ENTRY_LEN)
+  {
+    client = ch_clients_lookup(ssn_get_u16(&entry[0]));
+    if (client == NULL || (client->relayed && !from_border))
+    {
+      // Not ours, or a member that would bounce it back to the head
+      continue;
+    }
+
+    // Every client gets its own entry only
+    ssn_hdr_write(reply, SSN_MSG_SACK, node_id, ssn_get_u16(&sack[4]));
+    reply[SSN_HDR_LEN] = 1;
+    memcpy(&reply[SSN_SACK_LEN(0)], entry, SSN_SACK_ENTRY_LEN);
 
-int digits_only(const char *s)
+    if (client->relayed)
+    {
+      send_packet(NULL, reply, sizeof(reply), &client->addr, ch2ch_conn, UDP_CH2CH_PORT);
+    }
+    else
+    {
+      send_packet(NULL, reply, sizeof(reply), &client->addr, client_conn, UDP_CLIENT_LISTENING_PORT);
+    }
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+ctrl_report(void)
+{
+  // One line per round so the Cooja log can be parsed
+  printf("CTRL node %u round %u msgs %lu bytes %lu\n", node_id, election_seq, ctrl_msgs, ctrl_bytes);
+  printf("LINK node %u clients %d rx %lu lost %lu load %u interval %u\n",
+         node_id, ch_clients_count(), link_rx, link_lost, rate_avg, client_interval);
+}
+
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_AVERAGE
+/*---------------------------------------------------------------------------*/
+static uint32_t
+head_cost(const ch_peer_t *peer)
+{
+  // Load of the head, an attached client counts as one reading per minute
+  uint32_t cost = peer->load + peer->clients + 1;
+  // Every dB below -60 dBm makes the head 5% more expensive
+  int penalty = peer->rssi < -60 ? (-60 - peer->rssi) * 5 : 0;
+
+  return cost * (100 + penalty);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+select_active_ch(void)
 {
-  while (*s)
+  ch_peer_t *peer;
+  ch_peer_t *best = NULL;
+  ch_peer_t *current = ch_peers_lookup(&ch_ipaddr);
+
+  for (peer = ch_peers_head(); peer != NULL; peer = ch_peers_next(peer))
   {
-    if (isdigit(*s++) == 0)
-      return 0;
+    if (peer->is_head && (best == NULL || head_cost(peer) < head_cost(best)))
+    {
+      best = peer;
+    }
   }
 
-  return 1;
+  if (best == NULL || best == current)
+  {
+    return;
+  }
+
+  // Stay with the current head unless the other one is clearly less loaded
+  if (current != NULL && current->is_head &&
+      head_cost(best) * 100 > head_cost(current) * (100 - CH_CONF_LOAD_HYSTERESIS))
+  {
+    return;
+  }
+
+  ch_ipaddr = best->addr;
+  PRINTF("Forwarding to cluster head %u (load %u, clients %u, RSSI %d)\n",
+         best->node_id, best->load, best->clients, best->rssi);
+}
+
+/*---------------------------------------------------------------------------*/
+static int
+election_bid(void)
+{
+  int bid = abs(rand() % 1000 + 1);
+
+#if CH_CONF_ELECTION_BID == CH_BID_ENERGY
+  uint16_t since_head = election_seq - last_head_round;
+
+  // Nodes with more residual energy draw higher bids
+  bid = (uint32_t)bid * ssn_energy_residual_permille() / 1000;
+
+  // As in LEACH, a recent cluster head steps back for a few rounds
+  if (has_been_head && since_head < CH_CONF_ROTATION_ROUNDS)
+  {
+    bid = (uint32_t)bid * since_head / CH_CONF_ROTATION_ROUNDS;
+  }
+#endif
+
+  return bid;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+election_finish(void *ptr)
+{
+  ch_peer_t *peer;
+  long tot = random_number;
+  int average;
+
+  ctimer_stop(&election_timer);
+  election_state = ELECTION_IDLE;
+
+  for (peer = ch_peers_head(); peer != NULL; peer = ch_peers_next(peer))
+  {
+    if (peer->bid_round == election_seq)
+    {
+      tot += peer->bid;
+    }
+  }
+  average = tot / (num_of_bids + 1);
+
+  PRINTF("Round %u: %d of %d bids ; Tot = %ld ; Random number: %d ; Average = %d\n",
+         election_seq, num_of_bids, ch_peers_count(), tot, random_number, average);
+
+  for (peer = ch_peers_head(); peer != NULL; peer = ch_peers_next(peer))
+  {
+    peer->is_head = (peer->bid_round == election_seq && peer->bid >= average);
+  }
+
+  if (random_number >= average)
+  {
+    PRINTF("I am the cluster head\n");
+    ch_can_send = 1;
+    has_been_head = 1;
+    last_head_round = election_seq;
+
+    // Let the clients select the best CH right away
+    PRINTF("Sending multicast to clients to let them select the best CH\n");
+    multicast_send(SSN_MSG_BEACON, NULL, 0, mcast_conn);
+  }
+  else
+  {
+    PRINTF("I am NOT the cluster head\n");
+    // Readings collected while this node was the cluster head still go to the border router
+    batch_flush(NULL);
+    ch_can_send = 0;
+    // Select the least loaded active cluster head
+    uip_create_unspecified(&ch_ipaddr);
+    select_active_ch();
+  }
 }
 
 /*---------------------------------------------------------------------------*/
+static void
+election_start(uint16_t round)
+{
+  uint8_t bid[2];
+
+  // Only the live peers take part in the round
+  ch_peers_expire();
+
+  election_seq = round;
+  election_state = ELECTION_BIDDING;
+  num_of_bids = 0;
+  random_number = election_bid();
+
+  PRINTF("Sending CH multicast for CH election round %u\n", election_seq);
+  ssn_put_u16(bid, random_number);
+  multicast_send(SSN_MSG_BID, bid, sizeof(bid), mcast_conn_ch);
+
+  if (ch_peers_count() == 0)
+  {
+    // No other cluster head is alive, there is nobody to wait for
+    election_finish(NULL);
+    return;
+  }
+
+  ctimer_set(&election_timer, CH_CONF_ELECTION_TIMEOUT, election_finish, NULL);
+}
 
+/*---------------------------------------------------------------------------*/
+static void
+election_bid_received(uint16_t round, uint16_t val, const uip_ipaddr_t *addr, uint16_t from)
+{
+  // A bid is also a sign of life, a late joiner takes part right away
+  ch_peer_t *peer = ch_peers_refresh(addr, from);
+
+  if (peer != NULL)
+  {
+    ch_peers_link_update(peer, cc2420_last_rssi);
+  }
+
+  if ((int16_t)(round - election_seq) > 0)
+  {
+    // Another cluster head opened a new round: join it with our own bid
+    etimer_set(&election_et, CH_CONF_ELECTION_INTERVAL);
+    election_start(round);
+  }
+
+  if (round != election_seq || election_state != ELECTION_BIDDING)
+  {
+    PRINTF("Ignoring a late bid for round %u\n", round);
+    return;
+  }
+
+  if (peer == NULL || peer->bid_round == round)
+  {
+    return;
+  }
+
+  peer->bid_round = round;
+  peer->bid = val;
+  num_of_bids++;
+
+  if (num_of_bids >= ch_peers_count())
+  {
+    // Every live cluster head has bid, no need to wait for the timeout
+    election_finish(NULL);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+heartbeat_timeout(void)
+{
+  uint8_t body[SSN_HEARTBEAT_LEN - SSN_HDR_LEN];
+
+  ch_peers_expire();
+  ch_clients_expire();
+
+  if (!ch_can_send && election_state == ELECTION_IDLE && ch_peers_lookup(&ch_ipaddr) == NULL)
+  {
+    // The cluster head we forward to has failed, elect a new one now
+    PRINTF("Active cluster head lost, starting a new round\n");
+    etimer_set(&election_et, CH_CONF_ELECTION_INTERVAL);
+    election_start(election_seq + 1);
+  }
+
+  // Share the load of the last interval so the members can balance across heads
+  load = (uint32_t)forwarded * 60 * CLOCK_SECOND / CH_CONF_HEARTBEAT_INTERVAL;
+  forwarded = 0;
+
+  body[0] = ch_can_send ? SSN_ROLE_HEAD : SSN_ROLE_MEMBER;
+  body[1] = ch_clients_count();
+  ssn_put_u16(&body[2], load);
+  multicast_send(SSN_MSG_HEARTBEAT, body, sizeof(body), mcast_conn_ch);
+}
+
+#else /* CH_CONF_ELECTION_MODE == CH_ELECTION_HASH */
+/*---------------------------------------------------------------------------*/
+static uint32_t
+rotation_hash(uint16_t id, uint16_t round)
+{
+  // Murmur3 finalizer over the node id, the round and the network seed
+  uint32_t h = ((uint32_t)id << 16 | round) ^ CH_CONF_HASH_SEED;
+
+  h ^= h >> 16;
+  h *= 0x85EBCA6BUL;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35UL;
+  h ^= h >> 16;
+  return h;
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+beacon_timeout(void *ptr)
+{
+  PRINTF("Sending multicast to clients to let them select the best CH\n");
+  multicast_send(SSN_MSG_BEACON, NULL, 0, mcast_conn);
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+hash_election(uint16_t round)
+{
+  election_seq = round;
+  ch_clients_expire();
+
+  // Every node computes its own role, no election message is exchanged
+  if (rotation_hash(node_id, round) % 1000 < CH_CONF_HASH_HEAD_PERMILLE)
+  {
+    PRINTF("Round %u: I am the cluster head\n", round);
+    ch_can_send = 1;
+    // Jitter keeps the beacons of the heads from colliding
+    ctimer_set(&beacon_timer, rand() % CLOCK_SECOND, beacon_timeout, NULL);
+  }
+  else
+  {
+    PRINTF("Round %u: I am NOT the cluster head\n", round);
+    batch_flush(NULL);
+    ch_can_send = 0;
+    // The heads of this round are learnt from their beacons, until then
+    // readings go straight to the border router
+    uip_create_unspecified(&ch_ipaddr);
+    best_beacon_rssi = -128;
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+static void
+beacon_received(uint16_t round, const uip_ipaddr_t *addr)
+{
+  signed char rss = cc2420_last_rssi;
+
+  if ((int16_t)(round - election_seq) > 0)
+  {
+    // A head of a later round: we rebooted or missed rounds, catch up with it
+    PRINTF("Catching up from round %u to round %u\n", election_seq, round);
+    etimer_set(&election_et, CH_CONF_ELECTION_INTERVAL);
+    hash_election(round);
+  }
+
+  if (!ch_can_send && round == election_seq && rss > best_beacon_rssi)
+  {
+    best_beacon_rssi = rss;
+    ch_ipaddr = *addr;
+    PRINTF("Forwarding to the cluster head with RSSI %d\n", rss);
+  }
+}
+#endif /* CH_CONF_ELECTION_MODE */
+
+/*---------------------------------------------------------------------------*/
 static void
 tcpip_handler(void)
 {
-  char *appdata;
+  uint8_t *appdata;
+  ssn_hdr_t hdr;
 
   if (uip_newdata())
   {
-    appdata = (char *)uip_appdata;
-    appdata[uip_datalen()] = '\0';
+    appdata = (uint8_t *)uip_appdata;
 
-    if (strcmp(appdata, "A") == 0)
+    if (!ssn_hdr_read(appdata, uip_datalen(), &hdr))
     {
-      num_of_ch++;
-      PRINTF("num_of_ch = %d\n", num_of_ch);
+      PRINTF("Dropping a message with an unknown format\n");
+      return;
     }
 
-    if (digits_only(appdata))
+    switch (hdr.type)
     {
-      if (!ch_list_struct)
-      {
-        ch_list_struct = malloc(num_of_ch * sizeof(ch_list_t));
-      }
-
-      ch_list_struct[count] = (ch_list_t){.val = atoi(appdata), .addr = UIP_IP_BUF->srcipaddr};
-      tot += ch_list_struct[count].val;
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_AVERAGE
+    case SSN_MSG_HEARTBEAT:
+    {
+      ch_peer_t *peer = ch_peers_refresh(&UIP_IP_BUF->srcipaddr, hdr.node_id);
 
-      if (count == num_of_ch - 1)
+      if (peer != NULL && uip_datalen() >= SSN_HEARTBEAT_LEN)
       {
-        tot += random_number;
+        ch_peers_link_update(peer, cc2420_last_rssi);
+        peer->is_head = (appdata[SSN_HDR_LEN] == SSN_ROLE_HEAD);
+        peer->clients = appdata[SSN_HDR_LEN + 1];
+        peer->load = ssn_get_u16(&appdata[SSN_HDR_LEN + 2]);
 
-        int average = tot / (num_of_ch + 1);
-
-        PRINTF("Tot = %d ; Random number: %d ; Average = %d\n", tot, random_number, average);
-
-        if (random_number >= average)
-        {
-          PRINTF("I am the cluster head\n");
-          ch_can_send = 1;
-        }
-        else
+        if (!ch_can_send)
         {
-          PRINTF("I am NOT the cluster head\n");
-          ch_can_send = 0;
-          int i;
-          for (i = 0; i <= count; i++)
-          {
-            if (ch_list_struct[i].val >= average)
-            {
-              // Select an active cluster head
-              ch_ipaddr = ch_list_struct[i].addr;
-              break;
-            }
-          }
+          // Move to another head if the load has become skewed
+          select_active_ch();
         }
+      }
+      break;
+    }
 
-        tot = 0;
-        count = 0;
-        free(ch_list_struct);
-        ch_list_struct = NULL;
+    case SSN_MSG_BID:
+      if (uip_datalen() >= SSN_BID_LEN)
+      {
+        election_bid_received(hdr.seq, ssn_get_u16(&appdata[SSN_HDR_LEN]), &UIP_IP_BUF->srcipaddr, hdr.node_id);
       }
-      else
+      break;
+#else
+    case SSN_MSG_BEACON:
+      beacon_received(hdr.seq, &UIP_IP_BUF->srcipaddr);
+      break;
+#endif
+
+    case SSN_MSG_SACK:
+      // Acknowledgements of the collector, or of the head through us
+      if (uip_datalen() > SSN_HDR_LEN)
       {
-        count++;
+        sack_received(appdata, uip_datalen());
       }
-    }
+      break;
 
-    if (strcmp(appdata, "A") != 0 && !digits_only(appdata))
-    {
-      uip_ipaddr_t client_ipaddr = UIP_IP_BUF->srcipaddr;
-      PRINTF("DATA recv '%s' from ", appdata);
-      PRINT6ADDR(&client_ipaddr);
-      PRINTF("\n");
+    case SSN_MSG_SOLICIT:
+      solicit_received(&UIP_IP_BUF->srcipaddr);
+      break;
 
-      if (ch_can_send)
+    case SSN_MSG_DATA:
+      if (uip_datalen() >= SSN_DATA_LEN)
       {
-        // Redirect data to the border router
-        send_packet(NULL, appdata, border_ipaddr, border_conn, UDP_BORDER_PORT);
+        data_received(appdata, uip_datalen(), &hdr);
       }
-      else
+      break;
+
+    case SSN_MSG_BATCH:
+      // Samples a client buffered, or a client batch relayed by a peer
+      if (uip_datalen() > SSN_HDR_LEN)
       {
-        // Redirect data to an active CH
-        PRINTF("Send packet to the cluster head: ");
-        PRINT6ADDR(&ch_ipaddr);
-        PRINTF("\n");
-        send_packet(NULL, appdata, ch_ipaddr, ch2ch_conn, UDP_CH2CH_PORT);
+        data_received(appdata, uip_datalen(), &hdr);
       }
+      break;
 
-      // Send RSSI to client to regulate transmission power
-      signed char rss = calculate_RSSI(client_ipaddr);
-      char *rssi = malloc(4 * sizeof(char));
-      snprintf(rssi, 4, "%d", rss);
-      send_packet(NULL, rssi, client_ipaddr, client_conn, UDP_CLIENT_LISTENING_PORT);
-
-      free(rssi);
-      rssi = NULL;
+    default:
+      PRINTF("Ignoring message type %u\n", hdr.type);
+      break;
     }
   }
 }
@@ -289,10 +1068,6 @@ set_global_address(void)
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(udp_server_process, ev, data)
 {
-  static struct etimer random_number_et;
-  static struct etimer ch_election_et;
-  static struct etimer multicast_et;
-
   PROCESS_BEGIN();
   PROCESS_PAUSE();
 
@@ -345,9 +1120,27 @@ PROCESS_THREAD(udp_server_process, ev, data)
     PROCESS_EXIT();
   }
 
-  etimer_set(&random_number_et, 60 * CLOCK_SECOND);
-  etimer_set(&ch_election_et, 90 * CLOCK_SECOND);
-  etimer_set(&multicast_et, 120 * CLOCK_SECOND);
+  ssn_hdr_write(echo_buf, SSN_MSG_RSSI_ECHO, node_id, 0);
+
+  ssn_energy_init();
+#if MAC_CONF_WITH_TSCH
+  // Before the association table, which adds the cells of the clients
+  ssn_tsch_init();
+#endif
+  ch_peers_init();
+  ch_clients_init();
+  ch_queue_init();
+  ch_dedup_init();
+  ctimer_set(&rate_timer, CH_CONF_RATE_PERIOD, rate_update, NULL);
+
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_HASH
+  // Beacons of the other heads tell a member where to forward
+  beacon_conn = udp_new(NULL, UIP_HTONS(0), NULL);
+  udp_bind(beacon_conn, UIP_HTONS(MCAST_SINK_UDP_PORT));
+#else
+  etimer_set(&heartbeat_et, CH_CONF_ANNOUNCE_DELAY);
+#endif
+  etimer_set(&election_et, CH_CONF_ELECTION_BOOT_DELAY);
   while (1)
   {
     PROCESS_YIELD();
@@ -356,34 +1149,30 @@ PROCESS_THREAD(udp_server_process, ev, data)
       tcpip_handler();
     }
 
-    if (etimer_expired(&random_number_et))
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_AVERAGE
+    if (etimer_expired(&heartbeat_et))
     {
-      if (first_iteration == 0)
-      {
-        multicast_send("A", mcast_conn_ch);
-        first_iteration++;
-      }
-      random_number = abs(rand() % 1000 + 1);
-
-      etimer_set(&random_number_et, 150 * CLOCK_SECOND);
-    }
-
-    if (etimer_expired(&ch_election_et))
-    {
-      PRINTF("Sending CH multicast for CH election\n");
-
-      itoa(random_number, random_number_string, 10);
-      multicast_send(random_number_string, mcast_conn_ch);
-
-      etimer_set(&ch_election_et, 150 * CLOCK_SECOND);
+      // Jitter keeps the heartbeats of the peers from colliding
+      etimer_set(&heartbeat_et, CH_CONF_HEARTBEAT_INTERVAL - (rand() % CLOCK_SECOND));
+      heartbeat_timeout();
     }
+#endif
 
-    if (etimer_expired(&multicast_et))
+    if (etimer_expired(&election_et))
     {
-      PRINTF("Sending multicast to clients to let them select the best CH\n");
-
-      multicast_send("CH", mcast_conn);
-      etimer_set(&multicast_et, 150 * CLOCK_SECOND);
+      etimer_set(&election_et, CH_CONF_ELECTION_INTERVAL);
+      ctrl_report();
+#if MAC_CONF_WITH_TSCH
+      // The RPL parent may have changed since the last round
+      ssn_tsch_update_uplink();
+#endif
+#if CH_CONF_ELECTION_MODE == CH_ELECTION_HASH
+      // A node behind the others catches up with the round of their beacons
+      hash_election(election_seq + 1);
+#else
+      // Start the next round, the peers join it as soon as they receive our bid
+      election_start(election_seq + 1);
+#endif
     }
   }
 
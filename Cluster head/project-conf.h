@@ -41,10 +41,18 @@
 #define NBR_TABLE_CONF_MAX_NEIGHBORS 15
 #define UIP_CONF_MAX_ROUTES 20
 
+#if MAC_CONF_WITH_TSCH
+/* The cluster schedule of ssn-tsch replaces the 6TiSCH minimal one */
+#define TSCH_SCHEDULE_CONF_WITH_6TISCH_MINIMAL 0
+#define TSCH_SCHEDULE_CONF_MAX_SLOTFRAMES 2
+/* The shared cell, the uplink and one cell per client */
+#define TSCH_SCHEDULE_CONF_MAX_LINKS (CH_CONF_MAX_CLIENTS + 2)
+#else
 #undef NETSTACK_CONF_RDC
 #define NETSTACK_CONF_RDC nullrdc_driver
 #undef NULLRDC_CONF_802154_AUTOACK
 #define NULLRDC_CONF_802154_AUTOACK 1
+#endif
 
 /* Define as minutes */
 #define RPL_CONF_DEFAULT_LIFETIME_UNIT 60
@@ -54,6 +62,178 @@
 
 #define RPL_CONF_DEFAULT_ROUTE_INFINITE_LIFETIME 1
 
+/* Log every forwarded reading, the serial output is slow on the Z1 */
+#ifndef CH_CONF_TRACE_DATA
+#define CH_CONF_TRACE_DATA 0
+#endif
+
+/* Energest accounting feeds the election bid and the energy reports */
+#define ENERGEST_CONF_ON 1
+
+/*
+ * Election mode: bids averaged among the peers, or a message-free rotation
+ * where each node hashes its id with the round number and a network seed
+ */
+#define CH_ELECTION_AVERAGE 0
+#define CH_ELECTION_HASH 1
+#ifndef CH_CONF_ELECTION_MODE
+#define CH_CONF_ELECTION_MODE CH_ELECTION_AVERAGE
+#endif
+
+/* Hash mode: network seed and share of the nodes that are heads in a round */
+#ifndef CH_CONF_HASH_SEED
+#define CH_CONF_HASH_SEED 0x5EED1234UL
+#endif
+#ifndef CH_CONF_HASH_HEAD_PERMILLE
+#define CH_CONF_HASH_HEAD_PERMILLE 400
+#endif
+
+/* Election bid: a plain random draw, or weighted by the residual energy */
+#define CH_BID_RANDOM 0
+#define CH_BID_ENERGY 1
+#ifndef CH_CONF_ELECTION_BID
+#define CH_CONF_ELECTION_BID CH_BID_ENERGY
+#endif
+
+/* With energy bids, a head bids lower during this many rounds after its term */
+#ifndef CH_CONF_ROTATION_ROUNDS
+#define CH_CONF_ROTATION_ROUNDS 4
+#endif
+
+/* Capacity of the peer cluster head table */
+#ifndef CH_CONF_MAX_PEERS
+#define CH_CONF_MAX_PEERS 16
+#endif
+
+/* Interval between two heartbeats sent to the peer cluster heads */
+#ifndef CH_CONF_HEARTBEAT_INTERVAL
+#define CH_CONF_HEARTBEAT_INTERVAL (30 * CLOCK_SECOND)
+#endif
+
+/* A peer is removed after missing about three heartbeats */
+#ifndef CH_CONF_PEER_TIMEOUT
+#define CH_CONF_PEER_TIMEOUT (3 * CH_CONF_HEARTBEAT_INTERVAL + 5 * CLOCK_SECOND)
+#endif
+
+/* Capacity of the client association table */
+#ifndef CH_CONF_MAX_CLIENTS
+#define CH_CONF_MAX_CLIENTS 16
+#endif
+
+/* A client is dissociated after missing about three readings */
+#ifndef CH_CONF_CLIENT_TIMEOUT
+#define CH_CONF_CLIENT_TIMEOUT (100 * CLOCK_SECOND)
+#endif
+
+/* A member switches to another head only if it costs this many percent less */
+#ifndef CH_CONF_LOAD_HYSTERESIS
+#define CH_CONF_LOAD_HYSTERESIS 30
+#endif
+
+/* Sample interval of the clients, PERIOD in seconds from the Makefile. The CH
+ * moves it between the bounds to keep its load near the target. */
+#ifndef CH_CONF_SAMPLE_INTERVAL
+#ifdef PERIOD
+#define CH_CONF_SAMPLE_INTERVAL PERIOD
+#else
+#define CH_CONF_SAMPLE_INTERVAL 15
+#endif
+#endif
+#ifndef CH_CONF_SAMPLE_INTERVAL_MIN
+#define CH_CONF_SAMPLE_INTERVAL_MIN 5
+#endif
+#ifndef CH_CONF_SAMPLE_INTERVAL_MAX
+#define CH_CONF_SAMPLE_INTERVAL_MAX 240
+#endif
+/* Readings per minute from the direct clients the CH aims for */
+#ifndef CH_CONF_TARGET_LOAD
+#define CH_CONF_TARGET_LOAD 48
+#endif
+#ifndef CH_CONF_RATE_PERIOD
+#define CH_CONF_RATE_PERIOD (30 * CLOCK_SECOND)
+#endif
+/* The interval is held this long after a change, the longest a client goes between two reports */
+#ifndef CH_CONF_RATE_HOLD
+#define CH_CONF_RATE_HOLD (120 * CLOCK_SECOND)
+#endif
+
+/* Give every client its own uplink window in the echo, 0 lets them send at will */
+#ifndef CH_CONF_SLOT_ASSIGNMENT
+#define CH_CONF_SLOT_ASSIGNMENT 1
+#endif
+
+/* Batches held in RAM while the border router is unreachable */
+#ifndef CH_CONF_UPLINK_QUEUE_LEN
+#define CH_CONF_UPLINK_QUEUE_LEN 8
+#endif
+
+/* Spill the batches that do not fit in RAM to a Coffee file */
+#ifndef CH_CONF_UPLINK_QUEUE_CFS
+#define CH_CONF_UPLINK_QUEUE_CFS 0
+#endif
+#ifndef CH_CONF_UPLINK_QUEUE_CFS_FRAMES
+#define CH_CONF_UPLINK_QUEUE_CFS_FRAMES 64
+#endif
+
+/* Pace of the queued batches once the route is back */
+#ifndef CH_CONF_UPLINK_DRAIN_INTERVAL
+#define CH_CONF_UPLINK_DRAIN_INTERVAL (CLOCK_SECOND / 2)
+#endif
+
+/* Clients multiply their send interval by 2^shift while the queue is filling */
+#ifndef CH_CONF_BACKOFF_SHIFT
+#define CH_CONF_BACKOFF_SHIFT 2
+#endif
+#ifndef CH_CONF_BACKOFF_REFRESH
+#define CH_CONF_BACKOFF_REFRESH (60 * CLOCK_SECOND)
+#endif
+
+/* Recently forwarded readings remembered to drop duplicates */
+#ifndef CH_CONF_DEDUP_CACHE_SIZE
+#define CH_CONF_DEDUP_CACHE_SIZE 32
+#endif
+#ifndef CH_CONF_DEDUP_LIFETIME
+#define CH_CONF_DEDUP_LIFETIME (120 * CLOCK_SECOND)
+#endif
+
+/* Clients answered together after a solicitation, and the spread of the replies */
+#ifndef CH_CONF_SOLICIT_PENDING
+#define CH_CONF_SOLICIT_PENDING 4
+#endif
+#ifndef CH_CONF_SOLICIT_JITTER
+#define CH_CONF_SOLICIT_JITTER (CLOCK_SECOND / 2)
+#endif
+
+/* Delay before the first heartbeat announces this cluster head to its peers */
+#ifndef CH_CONF_ANNOUNCE_DELAY
+#define CH_CONF_ANNOUNCE_DELAY (5 * CLOCK_SECOND)
+#endif
+
+/* Delay before the first election round, leaves time for the announcements */
+#ifndef CH_CONF_ELECTION_BOOT_DELAY
+#define CH_CONF_ELECTION_BOOT_DELAY (10 * CLOCK_SECOND)
+#endif
+
+/* Time a round waits for missing bids before it is decided anyway */
+#ifndef CH_CONF_ELECTION_TIMEOUT
+#define CH_CONF_ELECTION_TIMEOUT (3 * CLOCK_SECOND)
+#endif
+
+/* Interval between election rounds, rotates the cluster heads */
+#ifndef CH_CONF_ELECTION_INTERVAL
+#define CH_CONF_ELECTION_INTERVAL (150 * CLOCK_SECOND)
+#endif
+
+/* Maximum number of client readings sent to the border router in one datagram */
+#ifndef CH_CONF_BATCH_SIZE
+#define CH_CONF_BATCH_SIZE 4
+#endif
+
+/* Maximum time the oldest reading waits in the batch before it is flushed */
+#ifndef CH_CONF_BATCH_FLUSH_INTERVAL
+#define CH_CONF_BATCH_FLUSH_INTERVAL (20 * CLOCK_SECOND)
+#endif
+
 // #define LOG_CONF_LEVEL_IPV6                        LOG_LEVEL_DBG
 // #define LOG_CONF_LEVEL_RPL                         LOG_LEVEL_DBG
 // #define LOG_CONF_LEVEL_6LOWPAN                     LOG_LEVEL_DBG
@@ -0,0 +1,83 @@
+#include "contiki.h"
+#include "sys/energest.h"
+#include "node-id.h"
+#include "ssn-energy.h"
+
+#include <stdio.h>
+
+/* Typical currents of the MSP430 and the CC2420 in uA */
+#define CURRENT_CPU 1800UL
+#define CURRENT_LPM 55UL
+#define CURRENT_TX 17700UL
+#define CURRENT_RX 20000UL
+#define SUPPLY_VOLTAGE 3UL
+
+static struct ctimer report_timer;
+
+/*---------------------------------------------------------------------------*/
+static void
+report_timeout(void *ptr)
+{
+  ssn_energy_report();
+  ctimer_reset(&report_timer);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_energy_init(void)
+{
+#if SSN_CONF_ENERGY_REPORT_INTERVAL
+  ctimer_set(&report_timer, SSN_CONF_ENERGY_REPORT_INTERVAL, report_timeout, NULL);
+#endif
+}
+
+/*---------------------------------------------------------------------------*/
+uint32_t
+ssn_energy_consumed_mj(void)
+{
+  uint64_t charge;
+
+  energest_flush();
+
+  // Charge in uA * ticks, then energy in mJ
+  charge = energest_type_time(ENERGEST_TYPE_CPU) * CURRENT_CPU +
+           energest_type_time(ENERGEST_TYPE_LPM) * CURRENT_LPM +
+           energest_type_time(ENERGEST_TYPE_TRANSMIT) * CURRENT_TX +
+           energest_type_time(ENERGEST_TYPE_LISTEN) * CURRENT_RX;
+
+  return charge * SUPPLY_VOLTAGE / ENERGEST_SECOND / 1000;
+}
+
+/*---------------------------------------------------------------------------*/
+uint16_t
+ssn_energy_residual_permille(void)
+{
+  uint32_t consumed = ssn_energy_consumed_mj();
+
+  if (consumed >= SSN_CONF_ENERGY_BUDGET_MJ)
+  {
+    return 0;
+  }
+
+  return 1000 - (uint64_t)consumed * 1000 / SSN_CONF_ENERGY_BUDGET_MJ;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_energy_report(void)
+{
+  uint32_t consumed = ssn_energy_consumed_mj();
+
+  // Share of the time the radio is on, in thousandths, to compare the MACs
+  uint16_t duty = (energest_type_time(ENERGEST_TYPE_TRANSMIT) + energest_type_time(ENERGEST_TYPE_LISTEN)) *
+                  1000 / ENERGEST_GET_TOTAL_TIME();
+
+  // Times are in seconds, one line per report so the Cooja log can be parsed
+  printf("ENERGEST node %u cpu %lu lpm %lu tx %lu rx %lu duty %u energy %lu mJ residual %u\n",
+         node_id,
+         (unsigned long)(energest_type_time(ENERGEST_TYPE_CPU) / ENERGEST_SECOND),
+         (unsigned long)(energest_type_time(ENERGEST_TYPE_LPM) / ENERGEST_SECOND),
+         (unsigned long)(energest_type_time(ENERGEST_TYPE_TRANSMIT) / ENERGEST_SECOND),
+         (unsigned long)(energest_type_time(ENERGEST_TYPE_LISTEN) / ENERGEST_SECOND),
+         duty, (unsigned long)consumed, ssn_energy_residual_permille());
+}
@@ -0,0 +1,37 @@
+/*
+ * Energy accounting from the Energest counters, shared by the client and
+ * the cluster head.
+ *
+ * The consumed energy is estimated from the time spent by the CPU and the
+ * CC2420 in each state, multiplied by the typical current drawn in that
+ * state, and compared with a battery budget.
+ */
+
+#ifndef SSN_ENERGY_H_
+#define SSN_ENERGY_H_
+
+#include "contiki.h"
+
+/* Battery budget, two AA cells by default (2500 mAh at 3 V) */
+#ifndef SSN_CONF_ENERGY_BUDGET_MJ
+#define SSN_CONF_ENERGY_BUDGET_MJ 27000000UL
+#endif
+
+/* Interval between two Energest reports on the serial line, 0 disables them */
+#ifndef SSN_CONF_ENERGY_REPORT_INTERVAL
+#define SSN_CONF_ENERGY_REPORT_INTERVAL (60 * CLOCK_SECOND)
+#endif
+
+/* Starts the periodic Energest reports */
+void ssn_energy_init(void);
+
+/* Energy consumed since boot, in mJ */
+uint32_t ssn_energy_consumed_mj(void);
+
+/* Estimated residual energy, in thousandths of the budget */
+uint16_t ssn_energy_residual_permille(void);
+
+/* Prints the Energest counters and the energy estimate */
+void ssn_energy_report(void);
+
+#endif /* SSN_ENERGY_H_ */
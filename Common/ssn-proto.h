@@ -0,0 +1,229 @@
+/*
+ * Binary wire protocol shared by the client, the cluster head and the
+ * UDP server collector.
+ *
+ * Every message starts with a fixed header:
+ *
+ *   0       1       2               4               6
+ *   +-------+-------+-------+-------+-------+-------+
+ *   |version| type  |    node id    |   sequence    |
+ *   +-------+-------+-------+-------+-------+-------+
+ *
+ * followed by a type-specific body. Multi-byte fields are big-endian and
+ * are always accessed byte by byte, so a message can be decoded straight
+ * from an unaligned receive buffer on the MSP430.
+ */
+
+#ifndef SSN_PROTO_H_
+#define SSN_PROTO_H_
+
+#include <stdint.h>
+
+#define SSN_PROTO_VERSION 1
+
+/* Message types */
+#define SSN_MSG_HEARTBEAT 0x01 /* CH -> CHs: periodic sign of life and load */
+#define SSN_MSG_BID 0x02       /* CH -> CHs: election bid, body is a uint16 */
+#define SSN_MSG_BEACON 0x03    /* CH -> clients: an active cluster head, no body */
+#define SSN_MSG_RSSI_ECHO 0x04 /* CH -> client: RSSI of the client's last packet */
+#define SSN_MSG_DATA 0x05      /* client -> CH: one reading */
+#define SSN_MSG_BATCH 0x06     /* client -> CH, CH -> border: several readings */
+#define SSN_MSG_BACKOFF 0x07   /* CH -> clients: slow down, the uplink is congested */
+#define SSN_MSG_SOLICIT 0x08   /* client -> CHs: asks the active heads for a beacon, no body */
+#define SSN_MSG_SACK 0x09      /* border -> CH -> client: selective acknowledgement */
+
+#define SSN_HDR_LEN 6
+
+/* Heartbeat: uint8 role, uint8 attached clients, uint16 readings per minute */
+#define SSN_HEARTBEAT_LEN (SSN_HDR_LEN + 4)
+#define SSN_ROLE_MEMBER 0
+#define SSN_ROLE_HEAD 1
+/* Bid: uint16 */
+#define SSN_BID_LEN (SSN_HDR_LEN + 2)
+/* Backoff: uint8 shift applied to the send interval, 0 resumes the normal rate */
+#define SSN_BACKOFF_LEN (SSN_HDR_LEN + 1)
+/*
+ * RSSI echo: int8 in dBm, uint8 slot of the client in the schedule of its
+ * CH, uint16 delay in ms until the next uplink window of that slot and
+ * uint16 sample interval in seconds the CH asks for
+ */
+#define SSN_RSSI_ECHO_LEN (SSN_HDR_LEN + 6)
+#define SSN_SLOT_NONE 0xFF
+
+/*
+ * Without TSCH, the CH splits a cycle into uplink windows and gives each
+ * client its own, so that the clients of a cluster never send together
+ */
+#define SSN_SLOT_CYCLE_MS 8000U
+#define SSN_SLOT_WINDOWS 16
+#define SSN_SLOT_WINDOW_MS (SSN_SLOT_CYCLE_MS / SSN_SLOT_WINDOWS)
+
+/*
+ * Selective acknowledgement: a one byte entry count followed by entries of
+ * uint16 node id, uint16 highest sequence number received and a uint16
+ * bitmap, bit i set when sequence number highest - 1 - i was received.
+ */
+#define SSN_SACK_ENTRY_LEN 6
+#define SSN_SACK_LEN(n) (SSN_HDR_LEN + 1 + (n) * SSN_SACK_ENTRY_LEN)
+#define SSN_SACK_MAX 8
+
+/*
+ * Reading record. In a DATA message the node id and sequence number are the
+ * ones of the header and only kind, value and age follow it. A BATCH carries
+ * a one byte record count followed by complete records.
+ */
+#define SSN_RECORD_LEN 9
+#define SSN_RECORD_AGE_OFFSET 7
+#define SSN_DATA_LEN (SSN_HDR_LEN + SSN_RECORD_LEN - 4)
+#define SSN_BATCH_LEN(n) (SSN_HDR_LEN + 1 + (n) * SSN_RECORD_LEN)
+/* Most records a batch may carry and still fit a single 802.15.4 frame */
+#define SSN_BATCH_MAX 8
+
+/*
+ * The node id and sequence number of the header are followed by the body,
+ * so a DATA message holds a complete record from this offset on and can be
+ * batched without decoding it.
+ */
+#define SSN_DATA_RECORD_OFFSET 2
+
+/*
+ * The upper bits of the kind are flags of the delivery mode: the client
+ * asks the collector to acknowledge the reading, or sends it again. Below
+ * them is the boot epoch of the client, which changes at every boot, so
+ * that the collector tells a restarted sequence from a late one.
+ */
+#define SSN_KIND_ACK_REQ 0x40
+#define SSN_KIND_RETX 0x80
+#define SSN_KIND_EPOCH_SHIFT 4
+#define SSN_KIND_EPOCH_MASK 0x30
+#define SSN_KIND_MASK 0x0F
+#define SSN_KIND_EPOCH(kind) (((kind) & SSN_KIND_EPOCH_MASK) >> SSN_KIND_EPOCH_SHIFT)
+#define SSN_KIND_EPOCHS 4
+
+/* Reading kinds */
+#define SSN_READING_RAW 0x00          /* value without a unit, e.g. an identifier */
+#define SSN_READING_TEMPERATURE 0x01  /* hundredths of a degree Celsius */
+#define SSN_READING_ACCELERATION 0x02 /* magnitude of the acceleration in mg */
+
+/* Age of a reading is counted in tenths of a second and saturates */
+#define SSN_AGE_MAX 0xFFFF
+
+typedef struct ssn_hdr
+{
+  uint8_t version;
+  uint8_t type;
+  uint16_t node_id;
+  uint16_t seq;
+} ssn_hdr_t;
+
+typedef struct ssn_record
+{
+  uint16_t node_id;
+  uint16_t seq;
+  uint8_t kind;
+  int16_t value;
+  uint16_t age;
+} ssn_record_t;
+
+/*---------------------------------------------------------------------------*/
+static inline void
+ssn_put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = v >> 8;
+  p[1] = v & 0xFF;
+}
+
+static inline uint16_t
+ssn_get_u16(const uint8_t *p)
+{
+  return ((uint16_t)p[0] << 8) | p[1];
+}
+
+/*---------------------------------------------------------------------------*/
+/* Writes a header at the start of buf and returns its length */
+static inline int
+ssn_hdr_write(uint8_t *buf, uint8_t type, uint16_t node_id, uint16_t seq)
+{
+  buf[0] = SSN_PROTO_VERSION;
+  buf[1] = type;
+  ssn_put_u16(&buf[2], node_id);
+  ssn_put_u16(&buf[4], seq);
+  return SSN_HDR_LEN;
+}
+
+/* Returns 1 if buf holds a header of the current protocol version */
+static inline int
+ssn_hdr_read(const uint8_t *buf, int len, ssn_hdr_t *hdr)
+{
+  if (len < SSN_HDR_LEN || buf[0] != SSN_PROTO_VERSION)
+  {
+    return 0;
+  }
+
+  hdr->version = buf[0];
+  hdr->type = buf[1];
+  hdr->node_id = ssn_get_u16(&buf[2]);
+  hdr->seq = ssn_get_u16(&buf[4]);
+  return 1;
+}
+
+/*---------------------------------------------------------------------------*/
+static inline int
+ssn_record_write(uint8_t *buf, const ssn_record_t *r)
+{
+  ssn_put_u16(&buf[0], r->node_id);
+  ssn_put_u16(&buf[2], r->seq);
+  buf[4] = r->kind;
+  ssn_put_u16(&buf[5], (uint16_t)r->value);
+  ssn_put_u16(&buf[7], r->age);
+  return SSN_RECORD_LEN;
+}
+
+static inline void
+ssn_record_read(const uint8_t *buf, ssn_record_t *r)
+{
+  r->node_id = ssn_get_u16(&buf[0]);
+  r->seq = ssn_get_u16(&buf[2]);
+  r->kind = buf[4];
+  r->value = (int16_t)ssn_get_u16(&buf[5]);
+  r->age = ssn_get_u16(&buf[7]);
+}
+
+/* The record of a DATA message is its header fields plus the body */
+static inline void
+ssn_data_read(const uint8_t *buf, const ssn_hdr_t *hdr, ssn_record_t *r)
+{
+  r->node_id = hdr->node_id;
+  r->seq = hdr->seq;
+  r->kind = buf[SSN_HDR_LEN];
+  r->value = (int16_t)ssn_get_u16(&buf[SSN_HDR_LEN + 1]);
+  r->age = ssn_get_u16(&buf[SSN_HDR_LEN + 3]);
+}
+
+static inline int
+ssn_data_write(uint8_t *buf, const ssn_record_t *r)
+{
+  ssn_hdr_write(buf, SSN_MSG_DATA, r->node_id, r->seq);
+  buf[SSN_HDR_LEN] = r->kind;
+  ssn_put_u16(&buf[SSN_HDR_LEN + 1], (uint16_t)r->value);
+  ssn_put_u16(&buf[SSN_HDR_LEN + 3], r->age);
+  return SSN_DATA_LEN;
+}
+
+/* Returns 1 if a SACK entry acknowledges this sequence number */
+static inline int
+ssn_sack_covers(uint16_t highest, uint16_t bitmap, uint16_t seq)
+{
+  uint16_t diff = highest - seq;
+
+  return diff == 0 || (diff <= 16 && (bitmap & (1U << (diff - 1))));
+}
+
+/* Adds elapsed tenths of a second to an age, saturating at SSN_AGE_MAX */
+static inline uint16_t
+ssn_age_add(uint16_t age, uint32_t elapsed)
+{
+  return (age + elapsed > SSN_AGE_MAX) ? SSN_AGE_MAX : (uint16_t)(age + elapsed);
+}
+
+#endif /* SSN_PROTO_H_ */
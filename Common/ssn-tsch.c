@@ -0,0 +1,164 @@
+#include "contiki.h"
+#include "ssn-tsch.h"
+
+#if MAC_CONF_WITH_TSCH
+#include "net/mac/tsch/tsch.h"
+#include "net/ipv6/uip-ds6.h"
+#include "net/routing/routing.h"
+#include "node-id.h"
+
+#define DEBUG DEBUG_PRINT
+#include "net/ipv6/uip-debug.h"
+
+static struct tsch_slotframe *sf_ctrl;
+static struct tsch_slotframe *sf_data;
+
+static linkaddr_t uplink_addr;
+static uint8_t uplink_set = 0;
+static uint8_t own_slot = SSN_SLOT_NONE;
+
+/*---------------------------------------------------------------------------*/
+static void
+ipaddr_to_linkaddr(const uip_ipaddr_t *ipaddr, linkaddr_t *addr)
+{
+  // The addresses of the nodes are autoconfigured from their link address
+  uip_ds6_set_lladdr_from_iid((uip_lladdr_t *)addr, ipaddr);
+}
+
+/*---------------------------------------------------------------------------*/
+static uint16_t
+cluster_offset(const linkaddr_t *ch)
+{
+  return SSN_TSCH_OFFSET_CLUSTER_FIRST + ch->u8[LINKADDR_SIZE - 1] % SSN_TSCH_OFFSET_CLUSTERS;
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_tsch_init(void)
+{
+  tsch_schedule_remove_all_slotframes();
+
+  sf_ctrl = tsch_schedule_add_slotframe(SSN_TSCH_SF_CTRL, SSN_CONF_TSCH_CTRL_LEN);
+  tsch_schedule_add_link(sf_ctrl,
+                         LINK_OPTION_TX | LINK_OPTION_RX | LINK_OPTION_SHARED | LINK_OPTION_TIME_KEEPING,
+                         LINK_TYPE_ADVERTISING, &tsch_broadcast_address, 0, SSN_TSCH_OFFSET_CTRL);
+
+  sf_data = tsch_schedule_add_slotframe(SSN_TSCH_SF_DATA, SSN_CONF_TSCH_DATA_LEN);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_tsch_listen_uplinks(void)
+{
+  int i;
+
+  for (i = 0; i < SSN_TSCH_UPLINK_SLOTS; i++)
+  {
+    tsch_schedule_add_link(sf_data, LINK_OPTION_RX | LINK_OPTION_SHARED, LINK_TYPE_NORMAL, &tsch_broadcast_address,
+                           1 + i, SSN_TSCH_OFFSET_UPLINK);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_tsch_update_uplink(void)
+{
+  struct tsch_neighbor *n = tsch_queue_get_time_source();
+  const linkaddr_t *parent = NULL;
+  uip_ipaddr_t root_ipaddr;
+  linkaddr_t root;
+  uint16_t slot = SSN_TSCH_UPLINK_SLOT(node_id);
+
+  // Only the border router listens in the uplink slots
+  if (n != NULL && NETSTACK_ROUTING.get_root_ipaddr(&root_ipaddr))
+  {
+    ipaddr_to_linkaddr(&root_ipaddr, &root);
+    if (linkaddr_cmp(tsch_queue_get_nbr_address(n), &root))
+    {
+      parent = tsch_queue_get_nbr_address(n);
+    }
+  }
+
+  if (parent == NULL)
+  {
+    // A neighbor with a dedicated TX cell gets no unicast in the shared cell,
+    // so a head behind another head drops its cell and uses the shared one
+    if (uplink_set)
+    {
+      tsch_schedule_remove_link_by_timeslot(sf_data, slot);
+      uplink_set = 0;
+      PRINTF("Uplink through the shared cell\n");
+    }
+    return;
+  }
+
+  if (uplink_set && linkaddr_cmp(&uplink_addr, parent))
+  {
+    return;
+  }
+
+  // The batches to the border router get a cell of their own. Heads whose ids
+  // are equal modulo SSN_TSCH_UPLINK_SLOTS share it: it is a shared cell, so
+  // that a collision is followed by a random backoff and not retried in step
+  tsch_schedule_remove_link_by_timeslot(sf_data, slot);
+  tsch_schedule_add_link(sf_data, LINK_OPTION_TX | LINK_OPTION_SHARED, LINK_TYPE_NORMAL, parent, slot,
+                         SSN_TSCH_OFFSET_UPLINK);
+  linkaddr_copy(&uplink_addr, parent);
+  uplink_set = 1;
+  PRINTF("Uplink cell at slot %u\n", slot);
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_tsch_add_client(uint8_t slot, const uip_ipaddr_t *addr)
+{
+  linkaddr_t client;
+
+  if (slot >= SSN_TSCH_CLIENT_SLOTS)
+  {
+    // Out of cells, the client keeps using the shared cell
+    return;
+  }
+
+  ipaddr_to_linkaddr(addr, &client);
+  tsch_schedule_remove_link_by_timeslot(sf_data, SSN_TSCH_CLIENT_SLOT_FIRST + slot);
+  tsch_schedule_add_link(sf_data, LINK_OPTION_TX | LINK_OPTION_RX, LINK_TYPE_NORMAL, &client,
+                         SSN_TSCH_CLIENT_SLOT_FIRST + slot, cluster_offset(&linkaddr_node_addr));
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_tsch_remove_client(uint8_t slot)
+{
+  if (slot < SSN_TSCH_CLIENT_SLOTS)
+  {
+    tsch_schedule_remove_link_by_timeslot(sf_data, SSN_TSCH_CLIENT_SLOT_FIRST + slot);
+  }
+}
+
+/*---------------------------------------------------------------------------*/
+void
+ssn_tsch_set_slot(uint8_t slot, const uip_ipaddr_t *ch_addr)
+{
+  linkaddr_t ch;
+
+  if (slot == own_slot)
+  {
+    return;
+  }
+
+  if (own_slot < SSN_TSCH_CLIENT_SLOTS)
+  {
+    tsch_schedule_remove_link_by_timeslot(sf_data, SSN_TSCH_CLIENT_SLOT_FIRST + own_slot);
+  }
+  own_slot = slot;
+
+  if (slot < SSN_TSCH_CLIENT_SLOTS && ch_addr != NULL)
+  {
+    ipaddr_to_linkaddr(ch_addr, &ch);
+    tsch_schedule_add_link(sf_data, LINK_OPTION_TX | LINK_OPTION_RX, LINK_TYPE_NORMAL, &ch,
+                           SSN_TSCH_CLIENT_SLOT_FIRST + slot, cluster_offset(&ch));
+    PRINTF("Data cell at slot %u\n", SSN_TSCH_CLIENT_SLOT_FIRST + slot);
+  }
+}
+#endif /* MAC_CONF_WITH_TSCH */
@@ -0,0 +1,81 @@
+/*
+ * TSCH schedule of the cluster network, used when building with
+ * MAKE_WITH_TSCH=1 instead of the always-on radio.
+ *
+ * Slotframe 0 has a single shared cell for the EBs, RPL, the multicast
+ * control traffic and the unicasts to a neighbor without a dedicated cell.
+ * Slotframe 1 holds the dedicated data cells:
+ *
+ *   slot 0                    unused, it may overlap the shared cell
+ *   slots 1 .. UPLINK_SLOTS   CH -> border router when it is the RPL parent,
+ *                             the slot of a CH is derived from its node
+ *                             id, the border router listens in all of them.
+ *                             Several heads may get the same slot, these
+ *                             cells are shared and back off on a collision
+ *   following slots           one TX/RX cell per client, on the channel
+ *                             offset of its cluster head, in the order of
+ *                             the association table of the CH
+ *
+ * A client only wakes up in the shared cell and in its own cell, and gets
+ * its slot in the RSSI echo of its cluster head.
+ */
+
+#ifndef SSN_TSCH_H_
+#define SSN_TSCH_H_
+
+#include "contiki.h"
+#include "ssn-proto.h"
+
+#ifndef SSN_CONF_TSCH_CTRL_LEN
+#define SSN_CONF_TSCH_CTRL_LEN 7
+#endif
+
+/* Coprime with the control slotframe, room for 16 clients per CH */
+#ifndef SSN_CONF_TSCH_DATA_LEN
+#define SSN_CONF_TSCH_DATA_LEN 23
+#endif
+
+#define SSN_TSCH_SF_CTRL 0
+#define SSN_TSCH_SF_DATA 1
+
+#define SSN_TSCH_UPLINK_SLOTS 4
+#define SSN_TSCH_UPLINK_SLOT(id) (1 + (id) % SSN_TSCH_UPLINK_SLOTS)
+#define SSN_TSCH_CLIENT_SLOT_FIRST (1 + SSN_TSCH_UPLINK_SLOTS)
+#define SSN_TSCH_CLIENT_SLOTS (SSN_CONF_TSCH_DATA_LEN - SSN_TSCH_CLIENT_SLOT_FIRST)
+
+/*
+ * Channel offsets of the four channel hopping sequence: the shared cell,
+ * the uplinks, then the clusters, so that two neighbouring clusters using
+ * the same slot are likely to be on different channels.
+ */
+#define SSN_TSCH_OFFSET_CTRL 0
+#define SSN_TSCH_OFFSET_UPLINK 1
+#define SSN_TSCH_OFFSET_CLUSTER_FIRST 2
+#define SSN_TSCH_OFFSET_CLUSTERS 2
+
+#if MAC_CONF_WITH_TSCH
+#include "net/linkaddr.h"
+#include "net/ipv6/uip.h"
+
+/* Replaces the schedule with the two slotframes and the shared cell */
+void ssn_tsch_init(void);
+
+/* Border router: listens in all the uplink cells */
+void ssn_tsch_listen_uplinks(void);
+
+/*
+ * Cluster head: moves its uplink cell to the current time source, the RPL
+ * parent, when that is the border router. A head whose parent is another
+ * head has no uplink cell and sends in the shared cell.
+ */
+void ssn_tsch_update_uplink(void);
+
+/* Cluster head: cell of the client with this slot index and address */
+void ssn_tsch_add_client(uint8_t slot, const uip_ipaddr_t *addr);
+void ssn_tsch_remove_client(uint8_t slot);
+
+/* Client: its cell with the cluster head, SSN_SLOT_NONE removes it */
+void ssn_tsch_set_slot(uint8_t slot, const uip_ipaddr_t *ch_addr);
+#endif /* MAC_CONF_WITH_TSCH */
+
+#endif /* SSN_TSCH_H_ */
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "collector.h"
+#include "metrics.h"
+
+/*
+ * Sequence numbers remembered per node, one bit each. A client retransmits
+ * a reading for up to CLIENT_CONF_RETX_MAX timeouts of 90 s, about 110
+ * readings at the shortest sample interval, so the window covers that.
+ * It divides 65536, a bit keeps its place when the sequence wraps.
+ */
+#define SEQ_WINDOW 512
+
+struct node_seen
+{
+    int active;
+    uint8_t epoch;     /* boot epoch of the readings being tracked */
+    uint16_t first;    /* first sequence number received in this epoch */
+    uint16_t highest;  /* highest sequence number received */
+    uint64_t window[SEQ_WINDOW / 64]; /* bit seq % SEQ_WINDOW set: seq was received */
+    unsigned long expected_before;  /* readings expected in the earlier epochs */
+    unsigned long received;
+    unsigned long duplicates;
+    unsigned long retransmissions;
+};
+
+static struct node_seen nodes[MAX_NODES];
+static unsigned long total_readings = 0;
+static unsigned long total_duplicates = 0;
+static unsigned long total_retransmissions = 0;
+static unsigned long total_sacks = 0;
+/* Sum of the ages of the delivered readings in tenths of a second, the latency */
+static unsigned long long total_age = 0;
+
+/* Readings expected from a node: every sequence number since the first one received, in every run */
+static unsigned long expected_readings(const struct node_seen *n)
+{
+    return n->expected_before + (uint16_t)(n->highest - n->first) + 1UL;
+}
+
+static int seq_seen(const struct node_seen *n, uint16_t seq)
+{
+    return (n->window[(seq % SEQ_WINDOW) / 64] >> (seq % 64)) & 1;
+}
+
+static void seq_set(struct node_seen *n, uint16_t seq, int seen)
+{
+    uint64_t bit = (uint64_t)1 << (seq % 64);
+
+    if (seen)
+    {
+        n->window[(seq % SEQ_WINDOW) / 64] |= bit;
+    }
+    else
+    {
+        n->window[(seq % SEQ_WINDOW) / 64] &= ~bit;
+    }
+}
+
+/* Starts tracking a node from this reading */
+static void node_start(struct node_seen *n, const ssn_record_t *r)
+{
+    n->active = 1;
+    n->epoch = SSN_KIND_EPOCH(r->kind);
+    n->first = r->seq;
+    n->highest = r->seq;
+    memset(n->window, 0, sizeof(n->window));
+    seq_set(n, r->seq, 1);
+}
+
+/* Returns 1 if the reading was already received, or cannot be told apart from one */
+static int is_duplicate(const ssn_record_t *r)
+{
+    struct node_seen *n;
+    uint16_t diff;
+    uint8_t epochs;
+
+    if (r->node_id >= MAX_NODES)
+    {
+        return 0;
+    }
+
+    n = &nodes[r->node_id];
+    if (!n->active)
+    {
+        node_start(n, r);
+        return 0;
+    }
+
+    if (SSN_KIND_EPOCH(r->kind) != n->epoch)
+    {
+        epochs = (SSN_KIND_EPOCH(r->kind) - n->epoch) & (SSN_KIND_EPOCHS - 1);
+        if (epochs == SSN_KIND_EPOCHS - 1)
+        {
+            /* A late reading from before the last reboot, its window is gone */
+            n->duplicates++;
+            return 1;
+        }
+
+        /* The node rebooted and counts again from 0 */
+        n->expected_before += expected_readings(n);
+        node_start(n, r);
+        return 0;
+    }
+
+    diff = n->highest - r->seq;
+    if (diff == 0 || (int16_t)diff > 0)
+    {
+        /* Older than the window: dropped rather than maybe delivered twice */
+        if (diff >= SEQ_WINDOW)
+        {
+            n->duplicates++;
+            return 1;
+        }
+
+        /* Not newer than the highest: a duplicate if its bit is set */
+        if (seq_seen(n, r->seq))
+        {
+            n->duplicates++;
+            return 1;
+        }
+        seq_set(n, r->seq, 1);
+        metrics_add(&node_metrics[r->node_id].late, 1);
+        return 0;
+    }
+
+    /* Newer: the sequence numbers skipped are not received yet */
+    diff = r->seq - n->highest;
+    metrics_add(&node_metrics[r->node_id].gaps, diff - 1);
+    if (diff >= SEQ_WINDOW)
+    {
+        memset(n->window, 0, sizeof(n->window));
+    }
+    else
+    {
+        while (++n->highest != r->seq)
+        {
+            seq_set(n, n->highest, 0);
+        }
+    }
+    n->highest = r->seq;
+    seq_set(n, r->seq, 1);
+    return 0;
+}
+
+static void print_record(const ssn_record_t *r)
+{
+    switch (r->kind & SSN_KIND_MASK)
+    {
+    case SSN_READING_TEMPERATURE:
+        printf("\nNode %u seq %u temperature %s%d.%02d C age %u.%us",
+               r->node_id, r->seq, r->value < 0 ? "-" : "", abs(r->value) / 100, abs(r->value) % 100,
+               r->age / 10, r->age % 10);
+        break;
+    case SSN_READING_ACCELERATION:
+        printf("\nNode %u seq %u acceleration %d mg age %u.%us",
+               r->node_id, r->seq, r->value, r->age / 10, r->age % 10);
+        break;
+    default:
+        printf("\nNode %u seq %u kind %u value %d age %u.%us",
+               r->node_id, r->seq, r->kind & SSN_KIND_MASK, r->value, r->age / 10, r->age % 10);
+        break;
+    }
+}
+
+/* Returns 1 if the reading is delivered, 0 for a duplicate */
+static int handle_record(const ssn_record_t *r, uint64_t received, int verbose)
+{
+    int duplicate;
+
+    total_readings++;
+    if (r->kind & SSN_KIND_RETX)
+    {
+        total_retransmissions++;
+        if (r->node_id < MAX_NODES)
+        {
+            nodes[r->node_id].retransmissions++;
+        }
+    }
+
+    duplicate = is_duplicate(r);
+    if (r->node_id < MAX_NODES)
+    {
+        metrics_reading(r, duplicate, received);
+    }
+
+    if (duplicate)
+    {
+        total_duplicates++;
+        if (verbose)
+        {
+            printf("\nDuplicate node %u seq %u (%lu duplicates in %lu readings)",
+                   r->node_id, r->seq, total_duplicates, total_readings);
+        }
+        return 0;
+    }
+
+    if (r->node_id < MAX_NODES)
+    {
+        nodes[r->node_id].received++;
+    }
+    total_age += r->age;
+
+    if (verbose)
+    {
+        print_record(r);
+    }
+    return 1;
+}
+
+static void print_delivery(void)
+{
+    unsigned long received = 0;
+    unsigned long expected = 0;
+    int i;
+
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (nodes[i].active)
+        {
+            received += nodes[i].received;
+            expected += expected_readings(&nodes[i]);
+        }
+    }
+
+    printf("\nDelivery %lu of %lu readings (%.1f%%), mean age %.1fs, %lu retransmissions (%.1f%% overhead), %lu SACKs sent",
+           received, expected, expected ? 100.0 * received / expected : 0.0, received ? total_age / 10.0 / received : 0.0,
+           total_retransmissions, received ? 100.0 * total_retransmissions / received : 0.0, total_sacks);
+    fflush(stdout);
+}
+
+/*
+ * Acknowledges the nodes that asked for it in this batch. The SACK goes back
+ * to the cluster head that sent the batch, which relays it to the clients.
+ */
+static void send_sack(int sock, const struct ingest_datagram *d, const ssn_record_t *records)
+{
+    uint8_t sack[SSN_SACK_LEN(SSN_SACK_MAX)];
+    uint8_t *entry = &sack[SSN_SACK_LEN(0)];
+    const ssn_record_t *record;
+    struct node_seen *n;
+    uint16_t bitmap;
+    int count = 0;
+    int i, j;
+
+    for (i = 0; i < d->count && count < SSN_SACK_MAX; i++)
+    {
+        record = &records[d->first + i];
+        if (!(record->kind & SSN_KIND_ACK_REQ) || record->node_id >= MAX_NODES)
+        {
+            continue;
+        }
+
+        /* One entry per node, it covers all its readings of the batch */
+        for (j = 0; j < count; j++)
+        {
+            if (ssn_get_u16(&sack[SSN_SACK_LEN(j)]) == record->node_id)
+            {
+                break;
+            }
+        }
+        if (j < count)
+        {
+            continue;
+        }
+
+        n = &nodes[record->node_id];
+        bitmap = 0;
+        for (j = 0; j < 16; j++)
+        {
+            bitmap |= seq_seen(n, n->highest - 1 - j) << j;
+        }
+        ssn_put_u16(&entry[0], record->node_id);
+        ssn_put_u16(&entry[2], n->highest);
+        ssn_put_u16(&entry[4], bitmap);
+        entry += SSN_SACK_ENTRY_LEN;
+        count++;
+    }
+
+    if (count == 0)
+    {
+        return;
+    }
+
+    ssn_hdr_write(sack, SSN_MSG_SACK, 0, d->hdr.seq);
+    sack[SSN_HDR_LEN] = count;
+    if (sendto(sock, sack, SSN_SACK_LEN(count), 0, (const struct sockaddr *)&d->from, sizeof(d->from)) > 0)
+    {
+        total_sacks++;
+    }
+}
+
+static void handle_batch(const struct ingest_batch *b, struct store *store, int verbose)
+{
+    const struct ingest_datagram *d;
+    int i, j;
+
+    for (i = 0; i < b->datagrams; i++)
+    {
+        d = &b->datagram[i];
+        if (verbose && d->hdr.type == SSN_MSG_BATCH)
+        {
+            printf("\nBatch %u from CH %u with %d readings", d->hdr.seq, d->hdr.node_id, d->count);
+        }
+
+        for (j = 0; j < d->count; j++)
+        {
+            if (handle_record(&b->record[d->first + j], b->received, verbose) && store != NULL &&
+                store_append(store, &b->record[d->first + j], d->hdr.node_id, b->received) < 0)
+            {
+                printf("\nError appending to the store, readings are no longer saved");
+                store = NULL;
+            }
+        }
+
+        /* The SACK must follow the window update of all the readings of the batch */
+        if (d->hdr.type == SSN_MSG_BATCH)
+        {
+            send_sack(b->sock, d, b->record);
+        }
+    }
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Takes up to COLLECTOR_BURST batches from every worker, returns how many */
+static int poll_rings(struct collector *c)
+{
+    struct ingest_worker *w;
+    struct ingest_batch *b;
+    int handled = 0;
+    int i, n;
+
+    for (i = 0; i < c->nworkers; i++)
+    {
+        w = &c->workers[i];
+        for (n = 0; n < COLLECTOR_BURST && (b = ring_pop(&w->full)) != NULL; n++)
+        {
+            handle_batch(b, c->store, c->verbose);
+            ring_push(&w->free, b);
+            handled++;
+        }
+    }
+    return handled;
+}
+
+static void wait_doorbell(struct collector *c)
+{
+    struct pollfd fd = { c->bell.fd, POLLIN, 0 };
+    uint64_t rung;
+
+    /* The rings are checked again after the flag is up, a push in between rings the bell */
+    atomic_store(&c->bell.waiting, 1);
+    /* The ring loads are only acquire: keep them after the store, as in doorbell_ring */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (poll_rings(c) == 0 && !atomic_load(&c->stop))
+    {
+        if (poll(&fd, 1, COLLECTOR_REPORT_INTERVAL) > 0 && read(c->bell.fd, &rung, sizeof(rung)) < 0)
+        {
+            perror("doorbell");
+        }
+    }
+    atomic_store(&c->bell.waiting, 0);
+}
+
+static void *collector_run(void *arg)
+{
+    struct collector *c = arg;
+    uint64_t reported = 0;
+    unsigned long printed = 0;
+    uint64_t now;
+
+    while (1)
+    {
+        if (poll_rings(c) == 0)
+        {
+            /* The workers are stopped before the flag is set, nothing comes after an empty round */
+            if (atomic_load(&c->stop))
+            {
+                break;
+            }
+            wait_doorbell(c);
+        }
+
+        /* A summary line instead of a line per reading */
+        now = now_ms();
+        if (now - reported >= COLLECTOR_REPORT_INTERVAL && total_readings != printed)
+        {
+            print_delivery();
+            if (c->store != NULL)
+            {
+                store_flush(c->store);
+            }
+            reported = now;
+            printed = total_readings;
+        }
+    }
+
+    return NULL;
+}
+
+int collector_start(struct collector *c)
+{
+    atomic_init(&c->stop, 0);
+    atomic_init(&c->bell.waiting, 0);
+    c->bell.fd = eventfd(0, EFD_NONBLOCK);
+    if (c->bell.fd < 0)
+    {
+        return -1;
+    }
+    return pthread_create(&c->thread, NULL, collector_run, c) == 0 ? 0 : -1;
+}
+
+void collector_stop(struct collector *c)
+{
+    uint64_t one = 1;
+
+    atomic_store(&c->stop, 1);
+    if (write(c->bell.fd, &one, sizeof(one)) < 0)
+    {
+        perror("doorbell");
+    }
+    pthread_join(c->thread, NULL);
+    close(c->bell.fd);
+}
+
+void collector_summary(void)
+{
+    int i;
+
+    /* Summary of the run, one line per node */
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (nodes[i].active)
+        {
+            printf("\nNode %d delivered %lu of %lu (%.1f%%), %lu duplicates, %lu retransmissions",
+                   i, nodes[i].received, expected_readings(&nodes[i]),
+                   100.0 * nodes[i].received / expected_readings(&nodes[i]),
+                   nodes[i].duplicates, nodes[i].retransmissions);
+        }
+    }
+    print_delivery();
+}
@@ -0,0 +1,47 @@
+/*
+ * Delivery stage of the collector.
+ *
+ * A single thread takes the decoded batches of all the receive workers, so
+ * the per-node state needs no lock. It drops the duplicates, keeps the
+ * delivery statistics, answers the readings that ask for it with a SACK
+ * and gives the batches back to their workers. It polls the full ring of
+ * every worker in turn and sleeps on its doorbell when they are all empty.
+ */
+
+#ifndef COLLECTOR_H_
+#define COLLECTOR_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "ingest.h"
+#include "store.h"
+
+/* Node ids above this are not tracked for duplicates */
+#define MAX_NODES 1024
+
+/* Delivery line printed at most this often, in ms */
+#define COLLECTOR_REPORT_INTERVAL 1000
+/* Batches taken from a ring before moving to the next one */
+#define COLLECTOR_BURST 8
+
+struct collector
+{
+    struct ingest_worker *workers;
+    int nworkers;
+    struct doorbell bell;
+    _Atomic int stop;
+    struct store *store;       /* where the delivered readings go, NULL to only count them */
+    int verbose;               /* prints every reading, for debugging */
+    pthread_t thread;
+};
+
+int collector_start(struct collector *c);
+
+/* Waits for the thread to drain the rings, once the workers are stopped */
+void collector_stop(struct collector *c);
+
+/* Per-node summary of the run */
+void collector_summary(void);
+
+#endif /* COLLECTOR_H_ */
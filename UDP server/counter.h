@@ -0,0 +1,26 @@
+/*
+ * Counters with a single writer, read live from other threads.
+ *
+ * The writer adds with a relaxed load and store instead of an atomic
+ * read-modify-write, it is the only one to change the counter. The
+ * readers, the metrics exporter and the exit summary, load it relaxed and
+ * never see a torn value.
+ */
+
+#ifndef COUNTER_H_
+#define COUNTER_H_
+
+#include <stdatomic.h>
+
+/* Writer only */
+static inline void counter_add(_Atomic unsigned long *counter, unsigned long n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline unsigned long counter_get(_Atomic unsigned long *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+#endif /* COUNTER_H_ */
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "ingest.h"
+
+/* Kernel receive buffer of a worker, it absorbs the bursts of the border routers */
+#define INGEST_RCVBUF (4 * 1024 * 1024)
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Appends the readings of a datagram to the batch */
+static void decode(struct ingest_worker *w, struct ingest_batch *b, const uint8_t *buf, int len,
+                   const struct sockaddr_in6 *from)
+{
+    struct ingest_datagram *d = &b->datagram[b->datagrams];
+    int count;
+    int i;
+
+    if (!ssn_hdr_read(buf, len, &d->hdr))
+    {
+        counter_add(&w->malformed, 1);
+        return;
+    }
+
+    switch (d->hdr.type)
+    {
+    case SSN_MSG_DATA:
+        if (len < SSN_DATA_LEN)
+        {
+            counter_add(&w->malformed, 1);
+            return;
+        }
+        ssn_data_read(buf, &d->hdr, &b->record[b->records]);
+        count = 1;
+        break;
+
+    case SSN_MSG_BATCH:
+        count = len > SSN_HDR_LEN ? buf[SSN_HDR_LEN] : 0;
+        if (count == 0 || count > SSN_BATCH_MAX || len < SSN_BATCH_LEN(count))
+        {
+            counter_add(&w->malformed, 1);
+            return;
+        }
+        for (i = 0; i < count; i++)
+        {
+            ssn_record_read(&buf[SSN_BATCH_LEN(i)], &b->record[b->records + i]);
+        }
+        break;
+
+    default:
+        counter_add(&w->ignored, 1);
+        return;
+    }
+
+    d->from = *from;
+    d->first = b->records;
+    d->count = count;
+    b->records += count;
+    b->datagrams++;
+    counter_add(&w->records, count);
+}
+
+/* Reads the pending datagrams into batches until the socket is empty */
+static int drain(struct ingest_worker *w, uint8_t buf[][INGEST_DATAGRAM_MAX], struct mmsghdr *msgs,
+                 struct iovec *iov, struct sockaddr_in6 *from)
+{
+    struct ingest_batch *b;
+    int n;
+    int i;
+
+    while (1)
+    {
+        for (i = 0; i < INGEST_VLEN; i++)
+        {
+            iov[i].iov_base = buf[i];
+            iov[i].iov_len = INGEST_DATAGRAM_MAX;
+            msgs[i].msg_hdr.msg_name = &from[i];
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = NULL;
+            msgs[i].msg_hdr.msg_controllen = 0;
+            msgs[i].msg_hdr.msg_flags = 0;
+        }
+
+        n = recvmmsg(w->sock, msgs, INGEST_VLEN, MSG_DONTWAIT, NULL);
+        if (n < 0)
+        {
+            return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+        }
+
+        /* A batch left empty by the previous call is reused, only the collector stage pushes to the free ring */
+        if (w->spare != NULL)
+        {
+            b = w->spare;
+            w->spare = NULL;
+        }
+        else
+        {
+            b = ring_pop(&w->free);
+        }
+        if (b == NULL)
+        {
+            /* The collector stage is behind, the datagrams are dropped here where they are counted */
+            counter_add(&w->datagrams, n);
+            counter_add(&w->dropped, n);
+            if (n < INGEST_VLEN)
+            {
+                return 0;
+            }
+            continue;
+        }
+
+        b->worker = w->id;
+        b->sock = w->sock;
+        b->received = now_ms();
+        b->datagrams = 0;
+        b->records = 0;
+        for (i = 0; i < n; i++)
+        {
+            counter_add(&w->datagrams, 1);
+            if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC)
+            {
+                counter_add(&w->malformed, 1);
+                continue;
+            }
+            decode(w, b, buf[i], msgs[i].msg_len, &from[i]);
+        }
+
+        /* The full ring has room for all the batches, the push cannot fail */
+        if (b->records == 0)
+        {
+            w->spare = b;
+        }
+        else
+        {
+            ring_push(&w->full, b);
+            doorbell_ring(w->bell);
+        }
+
+        if (n < INGEST_VLEN)
+        {
+            return 0;
+        }
+    }
+}
+
+static void *ingest_run(void *arg)
+{
+    struct ingest_worker *w = arg;
+    uint8_t buf[INGEST_VLEN][INGEST_DATAGRAM_MAX];
+    struct mmsghdr msgs[INGEST_VLEN];
+    struct iovec iov[INGEST_VLEN];
+    struct sockaddr_in6 from[INGEST_VLEN];
+    struct epoll_event events[2];
+    int n;
+    int i;
+
+    while (1)
+    {
+        n = epoll_wait(w->epoll_fd, events, 2, -1);
+        if (n < 0 && errno != EINTR)
+        {
+            perror("epoll_wait");
+            return NULL;
+        }
+
+        for (i = 0; i < n; i++)
+        {
+            if (events[i].data.fd == w->stop_fd)
+            {
+                return NULL;
+            }
+            if (drain(w, buf, msgs, iov, from) < 0)
+            {
+                return NULL;
+            }
+        }
+    }
+}
+
+int ingest_open(struct ingest_worker *w, int id, in_port_t port, struct ingest_batch *batches, int count,
+                struct doorbell *bell)
+{
+    struct sockaddr_in6 addr;
+    struct epoll_event ev;
+    int one = 1;
+    int rcvbuf = INGEST_RCVBUF;
+    int i;
+
+    memset(w, 0, sizeof(*w));
+    w->id = id;
+    w->bell = bell;
+    w->sock = -1;
+    w->stop_fd = -1;
+    w->epoll_fd = -1;
+    if (ring_init(&w->free, count) < 0 || ring_init(&w->full, count) < 0)
+    {
+        goto fail;
+    }
+    for (i = 0; i < count; i++)
+    {
+        ring_push(&w->free, &batches[i]);
+    }
+
+    w->sock = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (w->sock < 0)
+    {
+        goto fail;
+    }
+
+    /* Every worker binds the same port, the kernel balances the senders over them */
+    setsockopt(w->sock, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+    setsockopt(w->sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(port);
+    addr.sin6_addr = in6addr_any;
+    if (bind(w->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        goto fail;
+    }
+
+    w->stop_fd = eventfd(0, EFD_NONBLOCK);
+    w->epoll_fd = epoll_create1(0);
+    if (w->stop_fd < 0 || w->epoll_fd < 0)
+    {
+        goto fail;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.fd = w->sock;
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->sock, &ev);
+    ev.data.fd = w->stop_fd;
+    epoll_ctl(w->epoll_fd, EPOLL_CTL_ADD, w->stop_fd, &ev);
+    return 0;
+
+fail:
+    /* Undoes whatever was set up, the rest is still zero or -1 */
+    if (w->epoll_fd >= 0)
+    {
+        close(w->epoll_fd);
+    }
+    if (w->stop_fd >= 0)
+    {
+        close(w->stop_fd);
+    }
+    if (w->sock >= 0)
+    {
+        close(w->sock);
+    }
+    ring_free(&w->free);
+    ring_free(&w->full);
+    return -1;
+}
+
+int ingest_start(struct ingest_worker *w)
+{
+    cpu_set_t cpus;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (pthread_create(&w->thread, NULL, ingest_run, w) != 0)
+    {
+        return -1;
+    }
+
+    /* One worker per core, the scheduler keeps its socket data in that core's cache */
+    if (cores > 0)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(w->id % cores, &cpus);
+        pthread_setaffinity_np(w->thread, sizeof(cpus), &cpus);
+    }
+    return 0;
+}
+
+void ingest_stop(struct ingest_worker *w)
+{
+    uint64_t one = 1;
+
+    if (write(w->stop_fd, &one, sizeof(one)) < 0)
+    {
+        perror("eventfd");
+    }
+    pthread_join(w->thread, NULL);
+}
+
+void ingest_free(struct ingest_worker *w)
+{
+    close(w->epoll_fd);
+    close(w->stop_fd);
+    close(w->sock);
+    ring_free(&w->free);
+    ring_free(&w->full);
+}
@@ -0,0 +1,92 @@
+/*
+ * Receive workers of the collector.
+ *
+ * Every worker owns a UDP socket bound to the collector port with
+ * SO_REUSEPORT, so the kernel spreads the border routers over the workers
+ * by source address. A worker waits on its socket with epoll, drains it
+ * with recvmmsg INGEST_VLEN datagrams at a time and decodes them into one
+ * ingest batch, which it hands to the collector stage as a whole. Nothing
+ * is formatted or printed per datagram.
+ *
+ * The batches of a worker go around two SPSC rings: the full ones to the
+ * collector stage, the empty ones back. A worker that finds no empty batch
+ * still drains its socket, it drops and counts the datagrams instead of
+ * letting the kernel drop them silently while the collector stage is
+ * stalled.
+ */
+
+#ifndef INGEST_H_
+#define INGEST_H_
+
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "../Common/ssn-proto.h"
+#include "ring.h"
+#include "counter.h"
+
+/* Datagrams read by a single recvmmsg call */
+#define INGEST_VLEN 32
+/* Receive buffer of a datagram, larger than the longest valid message */
+#define INGEST_DATAGRAM_MAX 128
+#define INGEST_RECORDS (INGEST_VLEN * SSN_BATCH_MAX)
+
+/* A datagram holding readings, and where its records are in the batch */
+struct ingest_datagram
+{
+    struct sockaddr_in6 from;
+    ssn_hdr_t hdr;
+    int first;
+    int count;
+};
+
+/* Readings of one recvmmsg call */
+struct ingest_batch
+{
+    int worker;
+    int sock;           /* socket of the worker, to answer the senders */
+    uint64_t received;  /* reception time in ms since the epoch */
+    int datagrams;
+    int records;
+    struct ingest_datagram datagram[INGEST_VLEN];
+    ssn_record_t record[INGEST_RECORDS];
+};
+
+struct ingest_worker
+{
+    int id;
+    int sock;
+    int epoll_fd;
+    int stop_fd;               /* eventfd that wakes the worker up to stop */
+    pthread_t thread;
+    struct ring free;          /* empty batches, from the collector stage */
+    struct ring full;          /* decoded batches, to the collector stage */
+    struct doorbell *bell;     /* of the collector stage */
+    struct ingest_batch *spare; /* taken from the free ring but left empty */
+
+    /* Written by the worker only, read live by the metrics */
+    _Atomic unsigned long datagrams;
+    _Atomic unsigned long records;
+    _Atomic unsigned long malformed;   /* unknown format, truncated or too long */
+    _Atomic unsigned long ignored;     /* valid messages without readings */
+    _Atomic unsigned long dropped;     /* datagrams read while no batch was free */
+};
+
+/*
+ * Creates the socket and the rings of a worker, the batches given start in
+ * its free ring. Returns -1 if the socket cannot be bound.
+ */
+int ingest_open(struct ingest_worker *w, int id, in_port_t port, struct ingest_batch *batches, int count,
+                struct doorbell *bell);
+
+/* Runs the worker on a thread of its own, pinned to a core */
+int ingest_start(struct ingest_worker *w);
+
+/* Stops the worker and waits for its thread, the socket stays open for the SACKs */
+void ingest_stop(struct ingest_worker *w);
+
+/* Closes the socket and frees the rings once the collector stage is done with them */
+void ingest_free(struct ingest_worker *w);
+
+#endif /* INGEST_H_ */
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+
+#include "metrics-server.h"
+
+/* A client has this long to send its request, and to take each part of the page */
+#define METRICS_TIMEOUT_S 2
+
+static void serve(struct metrics_server *s, int fd)
+{
+    struct timeval timeout = { METRICS_TIMEOUT_S, 0 };
+    char request[1024];
+    FILE *out;
+
+    /* The request itself does not matter, its first bytes are enough to answer it */
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    if (read(fd, request, sizeof(request)) <= 0)
+    {
+        close(fd);
+        return;
+    }
+
+    out = fdopen(fd, "w");
+    if (out == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    fprintf(out, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n");
+    metrics_write(out, &s->source);
+    fclose(out);
+    s->served++;
+}
+
+static void *metrics_server_run(void *arg)
+{
+    struct metrics_server *s = arg;
+    struct pollfd fds[2];
+    int fd;
+
+    fds[0].fd = s->sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = s->stop_fd;
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return NULL;
+        }
+        if (fds[1].revents)
+        {
+            return NULL;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            fd = accept(s->sock, NULL, NULL);
+            if (fd >= 0)
+            {
+                serve(s, fd);
+            }
+        }
+    }
+}
+
+int metrics_server_start(struct metrics_server *s, in_port_t port, const struct metrics_source *source)
+{
+    struct sockaddr_in addr;
+    int one = 1;
+
+    memset(s, 0, sizeof(*s));
+    s->source = *source;
+
+    s->sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (s->sock < 0)
+    {
+        return -1;
+    }
+    setsockopt(s->sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s->sock, 8) < 0)
+    {
+        close(s->sock);
+        return -1;
+    }
+
+    s->stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (s->stop_fd < 0 || pthread_create(&s->thread, NULL, metrics_server_run, s) != 0)
+    {
+        close(s->sock);
+        return -1;
+    }
+    return 0;
+}
+
+void metrics_server_stop(struct metrics_server *s)
+{
+    uint64_t one = 1;
+
+    if (write(s->stop_fd, &one, sizeof(one)) < 0)
+    {
+        perror("eventfd");
+    }
+    pthread_join(s->thread, NULL);
+
+    close(s->stop_fd);
+    close(s->sock);
+}
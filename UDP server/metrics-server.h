@@ -0,0 +1,30 @@
+/*
+ * HTTP endpoint of the metrics, for a Prometheus server on the same host.
+ *
+ * Every request gets the whole metrics page, whatever its path, and the
+ * connection is closed after it. Requests are served one at a time by a
+ * thread of their own.
+ */
+
+#ifndef METRICS_SERVER_H_
+#define METRICS_SERVER_H_
+
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "metrics.h"
+
+struct metrics_server
+{
+    int sock;
+    int stop_fd;
+    pthread_t thread;
+    struct metrics_source source;
+    unsigned long served;
+};
+
+/* Listens on 127.0.0.1 only */
+int metrics_server_start(struct metrics_server *s, in_port_t port, const struct metrics_source *source);
+void metrics_server_stop(struct metrics_server *s);
+
+#endif /* METRICS_SERVER_H_ */
@@ -0,0 +1,205 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "metrics.h"
+#include "store.h"
+
+struct node_metrics node_metrics[MAX_NODES];
+
+/* Quantiles of the delay exported next to the histogram */
+static const double quantiles[] = { 0.5, 0.9, 0.99 };
+
+static uint64_t load(_Atomic uint64_t *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/* Largest age in tenths of a second that falls in a bucket */
+static unsigned long bucket_upper(int bucket)
+{
+    int group, shift;
+
+    if (bucket < METRICS_LINEAR)
+    {
+        return bucket;
+    }
+    group = (bucket - METRICS_LINEAR) / METRICS_SUB_BUCKETS;
+    shift = group + 1;
+    return ((unsigned long)(METRICS_SUB_BUCKETS + (bucket - METRICS_LINEAR) % METRICS_SUB_BUCKETS) << shift) +
+           (1UL << shift) - 1;
+}
+
+static int node_active(int node)
+{
+    return load(&node_metrics[node].readings) || load(&node_metrics[node].duplicates);
+}
+
+static void write_counter(FILE *out, const char *name, const char *help, size_t offset)
+{
+    int i;
+
+    fprintf(out, "# HELP %s %s\n# TYPE %s counter\n", name, help, name);
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (node_active(i))
+        {
+            fprintf(out, "%s{node=\"%d\"} %llu\n", name, i,
+                    (unsigned long long)load((_Atomic uint64_t *)((char *)&node_metrics[i] + offset)));
+        }
+    }
+}
+
+/* A snapshot of the delay buckets of a node, they may move while they are read. Returns their total */
+static uint64_t delay_snapshot(int node, uint32_t counts[METRICS_BUCKETS])
+{
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+        counts[i] = atomic_load_explicit(&node_metrics[node].delay[i], memory_order_relaxed);
+        total += counts[i];
+    }
+    return total;
+}
+
+static void write_delay(FILE *out, int node)
+{
+    uint32_t counts[METRICS_BUCKETS];
+    uint64_t total, cumulative = 0;
+    int i;
+
+    total = delay_snapshot(node, counts);
+
+    /* The histogram is exported at the end of the linear range and of every power of two */
+    for (i = 0; i < METRICS_BUCKETS; i++)
+    {
+        cumulative += counts[i];
+        if (i == METRICS_LINEAR - 1 || (i >= METRICS_LINEAR && (i - METRICS_LINEAR) % METRICS_SUB_BUCKETS == METRICS_SUB_BUCKETS - 1))
+        {
+            fprintf(out, "ssn_node_delay_seconds_bucket{node=\"%d\",le=\"%.1f\"} %llu\n",
+                    node, bucket_upper(i) / 10.0, (unsigned long long)cumulative);
+        }
+    }
+    fprintf(out, "ssn_node_delay_seconds_bucket{node=\"%d\",le=\"+Inf\"} %llu\n", node, (unsigned long long)total);
+    fprintf(out, "ssn_node_delay_seconds_sum{node=\"%d\"} %.1f\n", node, load(&node_metrics[node].delay_sum) / 10.0);
+    fprintf(out, "ssn_node_delay_seconds_count{node=\"%d\"} %llu\n", node, (unsigned long long)total);
+}
+
+/* Full resolution for the quantiles, at the upper edge of their bucket */
+static void write_delay_quantiles(FILE *out, int node)
+{
+    uint32_t counts[METRICS_BUCKETS];
+    uint64_t total, cumulative, target;
+    unsigned int q;
+    int i;
+
+    total = delay_snapshot(node, counts);
+    for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++)
+    {
+        target = (uint64_t)(quantiles[q] * total + 0.999999);
+        cumulative = 0;
+        for (i = 0; i < METRICS_BUCKETS - 1 && cumulative + counts[i] < target; i++)
+        {
+            cumulative += counts[i];
+        }
+        fprintf(out, "ssn_node_delay_quantile_seconds{node=\"%d\",quantile=\"%g\"} %.1f\n",
+                node, quantiles[q], total ? bucket_upper(i) / 10.0 : 0.0);
+    }
+}
+
+void metrics_write(FILE *out, const struct metrics_source *source)
+{
+    struct ingest_worker *w;
+    uint64_t gaps, late;
+    int i;
+
+    write_counter(out, "ssn_node_readings_total", "Readings delivered, without the duplicates.",
+                  offsetof(struct node_metrics, readings));
+    write_counter(out, "ssn_node_duplicates_total", "Readings received more than once.",
+                  offsetof(struct node_metrics, duplicates));
+    write_counter(out, "ssn_node_retransmissions_total", "Readings sent again by the node.",
+                  offsetof(struct node_metrics, retransmissions));
+    write_counter(out, "ssn_node_gaps_total", "Sequence numbers skipped by a newer reading.",
+                  offsetof(struct node_metrics, gaps));
+    write_counter(out, "ssn_node_late_total", "Readings that arrived after a newer one.",
+                  offsetof(struct node_metrics, late));
+
+    fprintf(out, "# HELP ssn_node_missing_readings Sequence numbers still missing.\n"
+                 "# TYPE ssn_node_missing_readings gauge\n");
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (node_active(i))
+        {
+            gaps = load(&node_metrics[i].gaps);
+            late = load(&node_metrics[i].late);
+            fprintf(out, "ssn_node_missing_readings{node=\"%d\"} %llu\n", i,
+                    (unsigned long long)(gaps > late ? gaps - late : 0));
+        }
+    }
+
+    fprintf(out, "# HELP ssn_node_last_seen_seconds Reception time of the last reading.\n"
+                 "# TYPE ssn_node_last_seen_seconds gauge\n");
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (node_active(i))
+        {
+            fprintf(out, "ssn_node_last_seen_seconds{node=\"%d\"} %.3f\n", i, load(&node_metrics[i].last_seen) / 1000.0);
+        }
+    }
+
+    fprintf(out, "# HELP ssn_node_delay_seconds Age of the readings at the collector, the end-to-end delay.\n"
+                 "# TYPE ssn_node_delay_seconds histogram\n");
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (node_active(i))
+        {
+            write_delay(out, i);
+        }
+    }
+
+    fprintf(out, "# HELP ssn_node_delay_quantile_seconds Quantiles of the delay at the full resolution of the histogram.\n"
+                 "# TYPE ssn_node_delay_quantile_seconds gauge\n");
+    for (i = 0; i < MAX_NODES; i++)
+    {
+        if (node_active(i))
+        {
+            write_delay_quantiles(out, i);
+        }
+    }
+
+    fprintf(out, "# HELP ssn_worker_datagrams_total Datagrams read by a receive worker.\n"
+                 "# TYPE ssn_worker_datagrams_total counter\n");
+    for (i = 0; i < source->nworkers; i++)
+    {
+        w = &source->workers[i];
+        fprintf(out, "ssn_worker_datagrams_total{worker=\"%d\"} %lu\n", i, counter_get(&w->datagrams));
+    }
+    fprintf(out, "# HELP ssn_worker_malformed_total Datagrams of a worker that could not be decoded.\n"
+                 "# TYPE ssn_worker_malformed_total counter\n");
+    for (i = 0; i < source->nworkers; i++)
+    {
+        w = &source->workers[i];
+        fprintf(out, "ssn_worker_malformed_total{worker=\"%d\"} %lu\n", i, counter_get(&w->malformed));
+    }
+    fprintf(out, "# HELP ssn_worker_dropped_total Datagrams a worker dropped while no batch was free.\n"
+                 "# TYPE ssn_worker_dropped_total counter\n");
+    for (i = 0; i < source->nworkers; i++)
+    {
+        w = &source->workers[i];
+        fprintf(out, "ssn_worker_dropped_total{worker=\"%d\"} %lu\n", i, counter_get(&w->dropped));
+    }
+    fprintf(out, "# HELP ssn_worker_ring_occupancy Batches waiting for the delivery stage.\n"
+                 "# TYPE ssn_worker_ring_occupancy gauge\n");
+    for (i = 0; i < source->nworkers; i++)
+    {
+        fprintf(out, "ssn_worker_ring_occupancy{worker=\"%d\"} %u\n", i, ring_occupancy(&source->workers[i].full));
+    }
+
+    if (source->store != NULL)
+    {
+        fprintf(out, "# HELP ssn_store_readings_total Readings appended to the store.\n"
+                     "# TYPE ssn_store_readings_total counter\n"
+                     "ssn_store_readings_total %lu\n", counter_get(&source->store->appended));
+    }
+}
@@ -0,0 +1,99 @@
+/*
+ * Live metrics of the collector, exported in the Prometheus text format.
+ *
+ * Every node has a fixed slot in a flat array indexed by its node id, with
+ * its counters and a histogram of the end-to-end delay of its readings.
+ * They are only written by the delivery stage, so an update is a relaxed
+ * load and store of a counter already in cache: no lock, no atomic
+ * read-modify-write and no allocation. The exporter reads them from
+ * another thread with relaxed loads.
+ *
+ * The delay histogram is log-linear like an HDR histogram: the ages below
+ * 16 tenths of a second have a bucket each, then every power of two is
+ * split in 8 buckets, which keeps the error under 12.5% up to the largest
+ * age in 112 buckets.
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "../Common/ssn-proto.h"
+#include "collector.h"
+
+#define METRICS_SUB_BITS 3
+#define METRICS_SUB_BUCKETS (1 << METRICS_SUB_BITS)
+#define METRICS_LINEAR (2 * METRICS_SUB_BUCKETS)
+#define METRICS_BUCKETS (METRICS_LINEAR + (16 - METRICS_SUB_BITS - 1) * METRICS_SUB_BUCKETS)
+
+struct node_metrics
+{
+    _Atomic uint64_t readings;       /* delivered */
+    _Atomic uint64_t duplicates;
+    _Atomic uint64_t retransmissions;
+    _Atomic uint64_t gaps;           /* sequence numbers skipped when a newer reading arrived */
+    _Atomic uint64_t late;           /* readings that filled one of those gaps */
+    _Atomic uint64_t last_seen;      /* ms since the epoch */
+    _Atomic uint64_t delay_sum;      /* tenths of a second */
+    _Atomic uint32_t delay[METRICS_BUCKETS];
+};
+
+/* The process-wide figures that are not per node */
+struct metrics_source
+{
+    struct ingest_worker *workers;
+    int nworkers;
+    struct store *store;
+};
+
+extern struct node_metrics node_metrics[MAX_NODES];
+
+/* Single writer: a plain increment that a reader on another thread never sees torn */
+static inline void metrics_add(_Atomic uint64_t *counter, uint64_t n)
+{
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static inline int metrics_bucket(uint16_t age)
+{
+    int msb;
+
+    if (age < METRICS_LINEAR)
+    {
+        return age;
+    }
+    msb = 31 - __builtin_clz(age);
+    return METRICS_LINEAR + (msb - METRICS_SUB_BITS - 1) * METRICS_SUB_BUCKETS +
+           ((age >> (msb - METRICS_SUB_BITS)) & (METRICS_SUB_BUCKETS - 1));
+}
+
+/* A reading of a known node arrived, duplicate or not */
+static inline void metrics_reading(const ssn_record_t *r, int duplicate, uint64_t received)
+{
+    struct node_metrics *m = &node_metrics[r->node_id];
+    _Atomic uint32_t *bucket;
+
+    if (r->kind & SSN_KIND_RETX)
+    {
+        metrics_add(&m->retransmissions, 1);
+    }
+    if (duplicate)
+    {
+        metrics_add(&m->duplicates, 1);
+        return;
+    }
+
+    metrics_add(&m->readings, 1);
+    metrics_add(&m->delay_sum, r->age);
+    bucket = &m->delay[metrics_bucket(r->age)];
+    atomic_store_explicit(bucket, atomic_load_explicit(bucket, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&m->last_seen, received, memory_order_relaxed);
+}
+
+/* Writes all the metrics in the Prometheus text format */
+void metrics_write(FILE *out, const struct metrics_source *source);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+
+#include "query-server.h"
+
+/* A client has this long to send its query, and to take each part of the answer */
+#define QUERY_TIMEOUT_S 2
+
+static void serve(struct query_server *s, int fd)
+{
+    struct timeval timeout = { QUERY_TIMEOUT_S, 0 };
+    char line[512];
+    char error[128];
+    struct query q;
+    size_t len = 0;
+    ssize_t n;
+    FILE *out;
+
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while (len < sizeof(line) - 1 && memchr(line, '\n', len) == NULL)
+    {
+        n = read(fd, &line[len], sizeof(line) - 1 - len);
+        if (n <= 0)
+        {
+            break;
+        }
+        len += n;
+    }
+    line[len] = '\0';
+
+    out = fdopen(fd, "w");
+    if (out == NULL)
+    {
+        close(fd);
+        return;
+    }
+
+    if (query_parse(&q, line, error, sizeof(error)) < 0)
+    {
+        fprintf(out, "error: %s\n", error);
+    }
+    else
+    {
+        query_run(&s->engine, &q, out);
+        s->served++;
+    }
+    fclose(out);
+}
+
+static void *query_server_run(void *arg)
+{
+    struct query_server *s = arg;
+    struct pollfd fds[2];
+    int fd;
+
+    fds[0].fd = s->sock;
+    fds[0].events = POLLIN;
+    fds[1].fd = s->stop_fd;
+    fds[1].events = POLLIN;
+
+    while (1)
+    {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR)
+        {
+            perror("poll");
+            return NULL;
+        }
+        if (fds[1].revents)
+        {
+            return NULL;
+        }
+        if (fds[0].revents & POLLIN)
+        {
+            fd = accept(s->sock, NULL, NULL);
+            if (fd >= 0)
+            {
+                serve(s, fd);
+            }
+        }
+    }
+}
+
+int query_server_start(struct query_server *s, const char *path, const char *dir)
+{
+    struct sockaddr_un addr;
+
+    memset(s, 0, sizeof(*s));
+    snprintf(s->path, sizeof(s->path), "%s", path);
+    query_engine_init(&s->engine, dir);
+
+    s->sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (s->sock < 0)
+    {
+        return -1;
+    }
+
+    /* A socket left by a previous run is replaced */
+    unlink(s->path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", s->path);
+    if (bind(s->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(s->sock, 8) < 0)
+    {
+        close(s->sock);
+        return -1;
+    }
+
+    s->stop_fd = eventfd(0, EFD_NONBLOCK);
+    if (s->stop_fd < 0 || pthread_create(&s->thread, NULL, query_server_run, s) != 0)
+    {
+        close(s->sock);
+        unlink(s->path);
+        return -1;
+    }
+    return 0;
+}
+
+void query_server_stop(struct query_server *s)
+{
+    uint64_t one = 1;
+
+    if (write(s->stop_fd, &one, sizeof(one)) < 0)
+    {
+        perror("eventfd");
+    }
+    pthread_join(s->thread, NULL);
+
+    close(s->stop_fd);
+    close(s->sock);
+    unlink(s->path);
+    query_engine_free(&s->engine);
+}
@@ -0,0 +1,33 @@
+/*
+ * Local socket of the collector for the dashboards.
+ *
+ * A client connects to the unix socket, writes one query line in the
+ * format of query.h and reads the CSV result until the collector closes
+ * the connection. Queries are served one at a time by a thread of their
+ * own, they read the segment files and never block the ingest path.
+ */
+
+#ifndef QUERY_SERVER_H_
+#define QUERY_SERVER_H_
+
+#include <pthread.h>
+
+#include "query.h"
+
+struct query_server
+{
+    char path[108];
+    int sock;
+    int stop_fd;
+    pthread_t thread;
+    struct query_engine engine;
+    unsigned long served;
+};
+
+/* Listens on the unix socket path for queries over the store in dir */
+int query_server_start(struct query_server *s, const char *path, const char *dir);
+
+/* Stops the thread and removes the socket */
+void query_server_stop(struct query_server *s);
+
+#endif /* QUERY_SERVER_H_ */
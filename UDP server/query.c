@@ -0,0 +1,461 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "query.h"
+
+/* Columns of a block, filled from the records before they are aggregated */
+struct block_columns
+{
+    uint64_t sampled[STORE_BLOCK_RECORDS];
+    int32_t value[STORE_BLOCK_RECORDS];
+    uint16_t node[STORE_BLOCK_RECORDS];
+    uint16_t ch[STORE_BLOCK_RECORDS];
+    uint8_t kind[STORE_BLOCK_RECORDS];
+};
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void query_engine_init(struct query_engine *e, const char *dir)
+{
+    memset(e, 0, sizeof(*e));
+    snprintf(e->dir, sizeof(e->dir), "%s", dir);
+}
+
+void query_engine_free(struct query_engine *e)
+{
+    int i;
+
+    for (i = 0; i < QUERY_CACHE; i++)
+    {
+        free(e->cache[i].start);
+        free(e->cache[i].positions);
+    }
+    memset(e->cache, 0, sizeof(e->cache));
+}
+
+/* Duration in ms of a number with an optional s, m, h or d suffix */
+static int parse_duration(const char *text, uint64_t *ms)
+{
+    char *end;
+    unsigned long long n = strtoull(text, &end, 10);
+    uint64_t unit = 1000;
+
+    switch (*end)
+    {
+    case '\0':
+    case 's':
+        break;
+    case 'm':
+        unit = 60 * 1000;
+        break;
+    case 'h':
+        unit = 3600 * 1000;
+        break;
+    case 'd':
+        unit = 24 * 3600 * 1000;
+        break;
+    default:
+        return -1;
+    }
+
+    if (end == text || (*end != '\0' && end[1] != '\0'))
+    {
+        return -1;
+    }
+    *ms = n * unit;
+    return 0;
+}
+
+int query_parse(struct query *q, const char *text, char *error, size_t size)
+{
+    char words[512];
+    char *word, *save, *value, *end;
+    uint64_t ms;
+
+    memset(q, 0, sizeof(*q));
+    q->to = UINT64_MAX;
+    q->node = -1;
+    q->ch = -1;
+    q->kind = -1;
+
+    snprintf(words, sizeof(words), "%s", text);
+    for (word = strtok_r(words, " \t\r\n", &save); word != NULL; word = strtok_r(NULL, " \t\r\n", &save))
+    {
+        if (strcmp(word, "agg") == 0)
+        {
+            q->aggregate = 1;
+            continue;
+        }
+
+        value = strchr(word, '=');
+        if (value == NULL)
+        {
+            snprintf(error, size, "expected key=value, got \"%s\"", word);
+            return -1;
+        }
+        *value++ = '\0';
+
+        if (strcmp(word, "last") == 0)
+        {
+            if (parse_duration(value, &ms) < 0)
+            {
+                snprintf(error, size, "bad duration \"%s\"", value);
+                return -1;
+            }
+            q->from = now_ms() > ms ? now_ms() - ms : 0;
+            continue;
+        }
+
+        ms = strtoull(value, &end, 10);
+        if (end == value || *end != '\0')
+        {
+            snprintf(error, size, "bad number \"%s\" for %s", value, word);
+            return -1;
+        }
+
+        if (strcmp(word, "node") == 0 || strcmp(word, "ch") == 0)
+        {
+            /* The node ids index the bitmaps and the posting lists */
+            if (ms >= STORE_NODES)
+            {
+                snprintf(error, size, "%s must be below %d", word, STORE_NODES);
+                return -1;
+            }
+            if (word[0] == 'n')
+            {
+                q->node = (int)ms;
+            }
+            else
+            {
+                q->ch = (int)ms;
+            }
+        }
+        else if (strcmp(word, "kind") == 0)
+        {
+            if (ms > SSN_KIND_MASK)
+            {
+                snprintf(error, size, "kind must be at most %d", SSN_KIND_MASK);
+                return -1;
+            }
+            q->kind = (int)ms;
+        }
+        else if (strcmp(word, "from") == 0)
+        {
+            q->from = ms * 1000;
+        }
+        else if (strcmp(word, "to") == 0)
+        {
+            q->to = ms * 1000;
+        }
+        else if (strcmp(word, "limit") == 0)
+        {
+            q->limit = ms;
+        }
+        else
+        {
+            snprintf(error, size, "unknown key \"%s\"", word);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Builds, or takes from the cache, the posting lists of the first count records of a segment */
+static const struct query_postings *postings_get(struct query_engine *e, const struct store_segment *seg, uint32_t count)
+{
+    struct query_postings *p = &e->cache[seg->index % QUERY_CACHE];
+    uint16_t node;
+    uint32_t i;
+    int n;
+
+    if (p->start != NULL && p->index == seg->index && p->count == count)
+    {
+        return p;
+    }
+
+    if (p->start == NULL)
+    {
+        p->start = malloc((STORE_NODES + 1) * sizeof(uint32_t));
+        p->positions = malloc(STORE_SEGMENT_RECORDS * sizeof(uint32_t));
+        if (p->start == NULL || p->positions == NULL)
+        {
+            free(p->start);
+            free(p->positions);
+            p->start = NULL;
+            p->positions = NULL;
+            return NULL;
+        }
+    }
+
+    /* Counting sort of the positions by node id */
+    memset(p->start, 0, (STORE_NODES + 1) * sizeof(uint32_t));
+    for (i = 0; i < count; i++)
+    {
+        if (seg->records[i].node_id < STORE_NODES)
+        {
+            p->start[seg->records[i].node_id + 1]++;
+        }
+    }
+    for (n = 0; n < STORE_NODES; n++)
+    {
+        p->start[n + 1] += p->start[n];
+    }
+    for (i = 0; i < count; i++)
+    {
+        node = seg->records[i].node_id;
+        if (node < STORE_NODES)
+        {
+            p->positions[p->start[node]++] = i;
+        }
+    }
+    /* The fill moved every start to the end of its list, the start of the next one */
+    for (n = STORE_NODES; n > 0; n--)
+    {
+        p->start[n] = p->start[n - 1];
+    }
+    p->start[0] = 0;
+
+    p->index = seg->index;
+    p->count = count;
+    return p;
+}
+
+static int segment_matches(const struct query *q, const struct store_header *h)
+{
+    return store_count(h) > 0 && h->min_sampled < q->to && h->max_sampled >= q->from &&
+           (q->node < 0 || store_has_node(h, q->node));
+}
+
+static int block_matches(const struct query *q, const struct store_header *h, uint32_t block)
+{
+    return h->block_min[block] < q->to && h->block_max[block] >= q->from;
+}
+
+static int record_matches(const struct query *q, const struct store_record *r)
+{
+    return r->sampled >= q->from && r->sampled < q->to &&
+           (q->node < 0 || r->node_id == q->node) &&
+           (q->ch < 0 || r->ch_id == q->ch) &&
+           (q->kind < 0 || (r->kind & SSN_KIND_MASK) == q->kind);
+}
+
+/* Maps the next segment that may hold matching records, returns 0 when there is none */
+static int next_segment(struct query_iter *it)
+{
+    uint32_t count;
+
+    while (++it->segment <= it->last)
+    {
+        if (store_segment_open(it->engine->dir, it->segment, &it->seg) < 0)
+        {
+            continue;
+        }
+        if (!segment_matches(&it->q, it->seg.header))
+        {
+            store_segment_close(&it->seg);
+            continue;
+        }
+
+        /* Records appended after this point are left to the next query */
+        count = store_count(it->seg.header);
+        it->postings = it->q.node >= 0 ? postings_get(it->engine, &it->seg, count) : NULL;
+        if (it->postings != NULL)
+        {
+            it->cursor = it->postings->start[it->q.node];
+            it->end = it->postings->start[it->q.node + 1];
+        }
+        else
+        {
+            it->cursor = 0;
+            it->end = count;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+void query_open(struct query_iter *it, struct query_engine *e, const struct query *q)
+{
+    memset(it, 0, sizeof(*it));
+    it->engine = e;
+    it->q = *q;
+    it->segment = -1;
+    it->last = store_last_index(e->dir);
+}
+
+const struct store_record *query_next(struct query_iter *it)
+{
+    const struct store_record *r;
+    uint32_t pos;
+
+    if (it->q.limit && it->returned >= it->q.limit)
+    {
+        return NULL;
+    }
+
+    while (1)
+    {
+        if (it->seg.header == NULL && !next_segment(it))
+        {
+            return NULL;
+        }
+
+        while (it->cursor < it->end)
+        {
+            if (it->postings != NULL)
+            {
+                pos = it->postings->positions[it->cursor++];
+            }
+            else
+            {
+                pos = it->cursor++;
+                if (pos % STORE_BLOCK_RECORDS == 0 && !block_matches(&it->q, it->seg.header, pos / STORE_BLOCK_RECORDS))
+                {
+                    /* The sparse index rules the whole block out */
+                    it->cursor = pos + STORE_BLOCK_RECORDS;
+                    continue;
+                }
+            }
+
+            r = &it->seg.records[pos];
+            if (record_matches(&it->q, r))
+            {
+                it->returned++;
+                return r;
+            }
+        }
+
+        store_segment_close(&it->seg);
+    }
+}
+
+void query_close(struct query_iter *it)
+{
+    store_segment_close(&it->seg);
+}
+
+/* Branch-free over the columns, the loop is vectorized */
+static void columns_aggregate(const struct query *q, const struct block_columns *c, int n, struct query_stats *stats)
+{
+    uint64_t from = q->from, to = q->to;
+    int any_node = q->node < 0, any_ch = q->ch < 0, any_kind = q->kind < 0;
+    uint16_t node = q->node, ch = q->ch;
+    uint8_t kind = q->kind;
+    int32_t vmin = stats->min, vmax = stats->max;
+    int64_t sum = 0;
+    unsigned long count = 0;
+    int i;
+
+    for (i = 0; i < n; i++)
+    {
+        int m = (c->sampled[i] >= from) & (c->sampled[i] < to) & (any_node | (c->node[i] == node)) &
+                (any_ch | (c->ch[i] == ch)) & (any_kind | (c->kind[i] == kind));
+        int32_t v = c->value[i];
+
+        count += m;
+        sum += v & -m;
+        vmin = (m & (v < vmin)) ? v : vmin;
+        vmax = (m & (v > vmax)) ? v : vmax;
+    }
+
+    stats->count += count;
+    stats->sum += sum;
+    stats->min = vmin;
+    stats->max = vmax;
+}
+
+static void column_set(struct block_columns *c, int i, const struct store_record *r)
+{
+    c->sampled[i] = r->sampled;
+    c->value[i] = r->value;
+    c->node[i] = r->node_id;
+    c->ch[i] = r->ch_id;
+    c->kind[i] = r->kind & SSN_KIND_MASK;
+}
+
+void query_aggregate(struct query_engine *e, const struct query *q, struct query_stats *stats)
+{
+    struct block_columns c;
+    struct query_iter it;
+    uint32_t block, pos, end;
+    int n;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->min = INT32_MAX;
+    stats->max = INT32_MIN;
+
+    query_open(&it, e, q);
+    while (next_segment(&it))
+    {
+        if (it.postings != NULL)
+        {
+            /* The records of the node, gathered block by block */
+            while (it.cursor < it.end)
+            {
+                for (n = 0; n < STORE_BLOCK_RECORDS && it.cursor < it.end; n++)
+                {
+                    column_set(&c, n, &it.seg.records[it.postings->positions[it.cursor++]]);
+                }
+                columns_aggregate(q, &c, n, stats);
+            }
+        }
+        else
+        {
+            for (block = 0; block * STORE_BLOCK_RECORDS < it.end; block++)
+            {
+                if (!block_matches(q, it.seg.header, block))
+                {
+                    continue;
+                }
+                pos = block * STORE_BLOCK_RECORDS;
+                end = pos + STORE_BLOCK_RECORDS < it.end ? pos + STORE_BLOCK_RECORDS : it.end;
+                for (n = 0; pos < end; n++, pos++)
+                {
+                    column_set(&c, n, &it.seg.records[pos]);
+                }
+                columns_aggregate(q, &c, n, stats);
+            }
+        }
+        store_segment_close(&it.seg);
+    }
+
+    if (stats->count == 0)
+    {
+        stats->min = 0;
+        stats->max = 0;
+    }
+}
+
+void query_run(struct query_engine *e, const struct query *q, FILE *out)
+{
+    struct query_stats stats;
+    struct query_iter it;
+    const struct store_record *r;
+
+    if (q->aggregate)
+    {
+        query_aggregate(e, q, &stats);
+        fprintf(out, "count,min,max,mean\n%lu,%d,%d,%.2f\n", stats.count, stats.min, stats.max,
+                stats.count ? (double)stats.sum / stats.count : 0.0);
+        return;
+    }
+
+    fprintf(out, "sampled,received,node,seq,ch,kind,value,age\n");
+    query_open(&it, e, q);
+    /* A reader that went away, or stalled past its timeout, ends the scan */
+    while (!ferror(out) && (r = query_next(&it)) != NULL)
+    {
+        fprintf(out, "%llu,%llu,%u,%u,%u,%u,%d,%u\n", (unsigned long long)r->sampled,
+                (unsigned long long)r->received, r->node_id, r->seq, r->ch_id, r->kind & SSN_KIND_MASK, r->value, r->age);
+    }
+    query_close(&it);
+}
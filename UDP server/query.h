@@ -0,0 +1,102 @@
+/*
+ * Range queries over the store.
+ *
+ * A query selects the readings sampled in [from, to), optionally of one
+ * node, one cluster head and one reading kind. Segments are skipped with
+ * the time range and the node bitmap of their header, and the blocks of a
+ * segment with its sparse time index. A query on a node walks the posting
+ * list of the node in each segment instead of its blocks: the positions of
+ * its records, built on the first query and kept for the sealed segments.
+ *
+ * The records come out of an iterator, segment by segment, so a query
+ * never holds its result in memory. Aggregates are computed block by
+ * block over columns of the block, with branch-free loops the compiler
+ * vectorizes.
+ *
+ * Queries are written as "key=value" words, the same for the ssn-query
+ * command and for the socket of the collector:
+ *
+ *   node=7 last=6h
+ *   ch=3 from=1760000000 to=1760003600 kind=1 agg
+ *
+ * from and to are in seconds since the epoch, last accepts the s, m, h and
+ * d suffixes, agg asks for count, min, max and mean instead of the records.
+ */
+
+#ifndef QUERY_H_
+#define QUERY_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "store.h"
+
+/* Posting lists of the segments kept between queries */
+#define QUERY_CACHE 16
+
+struct query
+{
+    uint64_t from;       /* sample time range in ms since the epoch */
+    uint64_t to;
+    int node;            /* -1 for any */
+    int ch;
+    int kind;            /* without the delivery flags */
+    int aggregate;
+    unsigned long limit; /* most records returned, 0 for all */
+};
+
+struct query_stats
+{
+    unsigned long count;
+    int min;
+    int max;
+    int64_t sum;
+};
+
+/* Positions of the records of every node in a segment, by node id */
+struct query_postings
+{
+    uint32_t index;
+    uint32_t count;        /* records of the segment when it was built */
+    uint32_t *start;       /* STORE_NODES + 1 offsets into positions */
+    uint32_t *positions;
+};
+
+struct query_engine
+{
+    char dir[256];
+    struct query_postings cache[QUERY_CACHE];
+};
+
+struct query_iter
+{
+    struct query_engine *engine;
+    struct query q;
+    long segment;          /* index of the mapped segment */
+    long last;
+    struct store_segment seg;
+    const struct query_postings *postings;
+    uint32_t cursor;       /* position in the segment or in the posting list */
+    uint32_t end;
+    unsigned long returned;
+};
+
+void query_engine_init(struct query_engine *e, const char *dir);
+void query_engine_free(struct query_engine *e);
+
+/* Parses the words of a query, returns -1 with a message in error otherwise */
+int query_parse(struct query *q, const char *text, char *error, size_t size);
+
+void query_open(struct query_iter *it, struct query_engine *e, const struct query *q);
+
+/* Next matching record, NULL at the end. It stays valid until the next call */
+const struct store_record *query_next(struct query_iter *it);
+
+void query_close(struct query_iter *it);
+
+void query_aggregate(struct query_engine *e, const struct query *q, struct query_stats *stats);
+
+/* Runs a query and prints its result as CSV, for the command and the socket */
+void query_run(struct query_engine *e, const struct query *q, FILE *out);
+
+#endif /* QUERY_H_ */
@@ -0,0 +1,80 @@
+#include <stdlib.h>
+
+#include "queue.h"
+
+int queue_init(struct queue *q, int capacity)
+{
+    q->items = calloc(capacity, sizeof(void *));
+    if (q->items == NULL)
+    {
+        return -1;
+    }
+
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    return 0;
+}
+
+void queue_destroy(struct queue *q)
+{
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+    free(q->items);
+}
+
+int queue_push(struct queue *q, void *item)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity && !q->closed)
+    {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+
+    if (q->closed)
+    {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+
+    q->items[(q->head + q->count) % q->capacity] = item;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+void *queue_pop(struct queue *q)
+{
+    void *item = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed)
+    {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+
+    if (q->count > 0)
+    {
+        item = q->items[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return item;
+}
+
+void queue_close(struct queue *q)
+{
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
@@ -0,0 +1,38 @@
+/*
+ * Bounded blocking queue of pointers, protected by a mutex with a condition
+ * variable per direction. Any number of threads may push and pop.
+ *
+ * The collector stages now use the SPSC rings of ring.h, this queue is the
+ * baseline ring_bench compares them with.
+ */
+
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <pthread.h>
+
+struct queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    void **items;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+};
+
+int queue_init(struct queue *q, int capacity);
+void queue_destroy(struct queue *q);
+
+/* Waits for room, returns -1 if the queue was closed */
+int queue_push(struct queue *q, void *item);
+
+/* Waits for an item, returns NULL once the queue is closed and empty */
+void *queue_pop(struct queue *q);
+
+/* Wakes up all the waiting threads, the items left can still be popped */
+void queue_close(struct queue *q);
+
+#endif /* QUEUE_H_ */
@@ -0,0 +1,164 @@
+/*
+ * Lock-free single-producer single-consumer ring of pointers.
+ *
+ * The producer only writes the tail and the consumer only writes the head,
+ * each on a cache line of its own next to the counters of its side, so the
+ * two threads never write to the same line. Each side also keeps a copy of
+ * the other side's index and only reads the shared one when its copy says
+ * the ring is full, or empty.
+ *
+ * A consumer fed by several rings sleeps on a doorbell when they are all
+ * empty, and a producer rings it only if the consumer said it is waiting,
+ * so the fast path has no system call.
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+#define RING_CACHE_LINE 64
+
+struct ring
+{
+    /* Producer side */
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t tail;
+    uint32_t head_cache;
+    unsigned long pushed;
+    unsigned long dropped;     /* pushes refused because the ring was full */
+    uint32_t high;             /* highest occupancy seen by the producer */
+
+    /* Consumer side */
+    _Alignas(RING_CACHE_LINE) _Atomic uint32_t head;
+    uint32_t tail_cache;
+    unsigned long popped;
+
+    /* Read-only once initialised */
+    _Alignas(RING_CACHE_LINE) uint32_t mask;
+    void **slots;
+};
+
+struct doorbell
+{
+    _Alignas(RING_CACHE_LINE) _Atomic int waiting;
+    int fd;                    /* eventfd the consumer polls */
+};
+
+/* Capacity is rounded up to a power of two */
+static inline int ring_init(struct ring *r, uint32_t capacity)
+{
+    uint32_t size = 1;
+
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+
+    r->slots = calloc(size, sizeof(void *));
+    if (r->slots == NULL)
+    {
+        return -1;
+    }
+    r->mask = size - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->head_cache = 0;
+    r->tail_cache = 0;
+    r->pushed = 0;
+    r->dropped = 0;
+    r->popped = 0;
+    r->high = 0;
+    return 0;
+}
+
+static inline void ring_free(struct ring *r)
+{
+    free(r->slots);
+    r->slots = NULL;
+}
+
+/* Producer only. Returns -1 and counts a drop if the ring is full */
+static inline int ring_push(struct ring *r, void *item)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t used = tail - r->head_cache;
+
+    if (used > r->mask)
+    {
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        used = tail - r->head_cache;
+        if (used > r->mask)
+        {
+            r->dropped++;
+            return -1;
+        }
+    }
+
+    r->slots[tail & r->mask] = item;
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    r->pushed++;
+    if (used + 1 > r->high)
+    {
+        r->high = used + 1;
+    }
+    return 0;
+}
+
+/* Consumer only. Returns NULL if the ring is empty */
+static inline void *ring_pop(struct ring *r)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    void *item;
+
+    if (head == r->tail_cache)
+    {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (head == r->tail_cache)
+        {
+            return NULL;
+        }
+    }
+
+    item = r->slots[head & r->mask];
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    r->popped++;
+    return item;
+}
+
+/* Items in the ring, exact from either side, a snapshot from anywhere else */
+static inline uint32_t ring_occupancy(struct ring *r)
+{
+    return atomic_load_explicit(&r->tail, memory_order_acquire) - atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+static inline uint32_t ring_capacity(const struct ring *r)
+{
+    return r->mask + 1;
+}
+
+/* Producer, after a push: wakes the consumer up if it is waiting */
+static inline void doorbell_ring(struct doorbell *d)
+{
+    uint64_t one = 1;
+
+    /*
+     * The push is a release store, which may be ordered after the load of
+     * waiting below: the consumer could then find the rings empty while we
+     * see it not waiting yet, and sleep on an item nobody rings for. The
+     * fence pairs with the one after its store of waiting.
+     */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&d->waiting) && atomic_exchange(&d->waiting, 0))
+    {
+        if (write(d->fd, &one, sizeof(one)) < 0)
+        {
+            perror("doorbell");
+        }
+    }
+}
+
+#endif /* RING_H_ */
@@ -0,0 +1,217 @@
+/*
+ * Compares the SPSC ring of the collector with the mutex and condition
+ * variable queue it replaced, between two threads:
+ *
+ * - throughput: the producer hands over items as fast as it can
+ * - latency: the producer hands over items at a fixed rate, the consumer
+ *   measures how long each one waited, at the batch rates of a collector
+ *   worker from a few border routers up to a loaded core
+ *
+ * The ring consumer sleeps on a doorbell when the ring is empty, like the
+ * delivery stage of the collector, so both queues pay for a wake-up.
+ *
+ * Build and run with:
+ *
+ *   gcc -O2 -Wall -pthread -o ring_bench ring_bench.c queue.c
+ *   ./ring_bench [items]
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "ring.h"
+#include "queue.h"
+
+#define DEFAULT_ITEMS 1000000
+#define CAPACITY 256
+
+struct item
+{
+    uint64_t pushed;   /* ns */
+    uint64_t popped;
+};
+
+struct bench
+{
+    int use_ring;
+    struct ring ring;
+    struct doorbell bell;
+    struct queue queue;
+    struct item *items;
+    long count;
+    long rate;         /* items per second, 0 for as fast as possible */
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void *producer(void *arg)
+{
+    struct bench *b = arg;
+    uint64_t start = now_ns();
+    struct timespec ts;
+    uint64_t due;
+    long i;
+
+    for (i = 0; i < b->count; i++)
+    {
+        if (b->rate)
+        {
+            /* Sleeping leaves the core to the consumer when they share one */
+            due = start + (uint64_t)i * 1000000000 / b->rate;
+            ts.tv_sec = due / 1000000000;
+            ts.tv_nsec = due % 1000000000;
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        }
+
+        b->items[i].pushed = now_ns();
+        if (b->use_ring)
+        {
+            while (ring_push(&b->ring, &b->items[i]) < 0)
+            {
+                sched_yield();
+            }
+            doorbell_ring(&b->bell);
+        }
+        else
+        {
+            queue_push(&b->queue, &b->items[i]);
+        }
+    }
+    return NULL;
+}
+
+/* Same protocol as the delivery stage: the ring is checked again after the flag is up */
+static struct item *wait_pop(struct bench *b)
+{
+    struct item *item;
+    uint64_t rung;
+
+    while ((item = ring_pop(&b->ring)) == NULL)
+    {
+        atomic_store(&b->bell.waiting, 1);
+        atomic_thread_fence(memory_order_seq_cst);
+        if ((item = ring_pop(&b->ring)) != NULL)
+        {
+            atomic_store(&b->bell.waiting, 0);
+            break;
+        }
+        if (read(b->bell.fd, &rung, sizeof(rung)) < 0)
+        {
+            perror("doorbell");
+            exit(1);
+        }
+        atomic_store(&b->bell.waiting, 0);
+    }
+    return item;
+}
+
+static void consume(struct bench *b)
+{
+    struct item *item;
+    long i;
+
+    for (i = 0; i < b->count; i++)
+    {
+        if (b->use_ring)
+        {
+            item = wait_pop(b);
+        }
+        else
+        {
+            item = queue_pop(&b->queue);
+        }
+        item->popped = now_ns();
+    }
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void run(int use_ring, long count, long rate)
+{
+    struct bench b;
+    pthread_t thread;
+    uint64_t start, elapsed;
+    uint64_t *waits;
+    long i;
+
+    memset(&b, 0, sizeof(b));
+    b.use_ring = use_ring;
+    b.count = count;
+    b.rate = rate;
+    b.items = calloc(count, sizeof(struct item));
+    waits = calloc(count, sizeof(uint64_t));
+    if (b.items == NULL || waits == NULL || ring_init(&b.ring, CAPACITY) < 0 || queue_init(&b.queue, CAPACITY) < 0)
+    {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    atomic_init(&b.bell.waiting, 0);
+    b.bell.fd = eventfd(0, 0);
+    if (b.bell.fd < 0)
+    {
+        perror("eventfd");
+        exit(1);
+    }
+
+    start = now_ns();
+    pthread_create(&thread, NULL, producer, &b);
+    consume(&b);
+    pthread_join(thread, NULL);
+    elapsed = now_ns() - start;
+
+    for (i = 0; i < count; i++)
+    {
+        waits[i] = b.items[i].popped - b.items[i].pushed;
+    }
+    qsort(waits, count, sizeof(uint64_t), compare);
+
+    printf("%-6s %9ld %12.0f %10.2f %10.2f %10.2f\n", use_ring ? "ring" : "mutex", rate,
+           count * 1e9 / elapsed, waits[count / 2] / 1e3, waits[count * 99 / 100] / 1e3, waits[count - 1] / 1e3);
+
+    ring_free(&b.ring);
+    close(b.bell.fd);
+    queue_destroy(&b.queue);
+    free(b.items);
+    free(waits);
+}
+
+int main(int argc, char *argv[])
+{
+    /* Batches per second of one worker, 0 is as fast as possible */
+    static const long rates[] = { 0, 1000, 10000, 100000 };
+    long count = argc > 1 ? atol(argv[1]) : DEFAULT_ITEMS;
+    long paced;
+    unsigned int i;
+
+    if (count < 1)
+    {
+        count = DEFAULT_ITEMS;
+    }
+
+    printf("%-6s %9s %12s %10s %10s %10s\n", "queue", "rate", "items/s", "p50 us", "p99 us", "max us");
+    for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+    {
+        /* A paced run lasts about a second */
+        paced = rates[i] && rates[i] < count ? rates[i] : count;
+        run(1, paced, rates[i]);
+        run(0, paced, rates[i]);
+    }
+    return 0;
+}
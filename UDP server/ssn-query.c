@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "query.h"
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [-d dir] key=value... [agg]\n", name);
+    printf("  -d     directory of the store, \"data\" by default\n");
+    printf("  node   readings of one node\n");
+    printf("  ch     readings relayed by one cluster head\n");
+    printf("  kind   reading kind, 1 temperature, 2 acceleration\n");
+    printf("  from   start of the sample time range, seconds since the epoch\n");
+    printf("  to     end of the range, excluded\n");
+    printf("  last   range ending now, e.g. last=6h\n");
+    printf("  limit  most readings printed\n");
+    printf("  agg    count, min, max and mean instead of the readings\n");
+}
+
+int main(int argc, char *argv[])
+{
+    struct query_engine engine;
+    struct query q;
+    const char *dir = "data";
+    char text[512] = "";
+    char error[128];
+    size_t len = 0, word;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "d:h")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+            dir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    /* The words of the command line are a query line of the collector socket */
+    for (i = optind; i < argc; i++)
+    {
+        word = strlen(argv[i]);
+        if (len + word + 2 > sizeof(text))
+        {
+            fprintf(stderr, "query too long\n");
+            return -1;
+        }
+        memcpy(&text[len], argv[i], word);
+        len += word;
+        text[len++] = ' ';
+        text[len] = '\0';
+    }
+
+    if (query_parse(&q, text, error, sizeof(error)) < 0)
+    {
+        fprintf(stderr, "%s\n", error);
+        return -1;
+    }
+
+    query_engine_init(&engine, dir);
+    query_run(&engine, &q, stdout);
+    query_engine_free(&engine);
+    return 0;
+}
@@ -0,0 +1,327 @@
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "store.h"
+
+/* The record layout is part of the file format */
+typedef char store_record_is_32_bytes[sizeof(struct store_record) == 32 ? 1 : -1];
+typedef char store_header_fits[sizeof(struct store_header) <= STORE_HEADER_SIZE ? 1 : -1];
+
+/* FNV-1a of the record up to its checksum, 0 is kept for the empty slots */
+static uint32_t record_check(const struct store_record *r)
+{
+    const uint8_t *p = (const uint8_t *)r;
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < offsetof(struct store_record, check); i++)
+    {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h ? h : 1;
+}
+
+int store_record_valid(const struct store_record *r)
+{
+    return r->check != 0 && r->check == record_check(r);
+}
+
+static void segment_path(char *path, size_t size, const char *dir, uint32_t index)
+{
+    snprintf(path, size, "%s/%08u.seg", dir, index);
+}
+
+static int segment_map(struct store_segment *seg, const char *path, int writable)
+{
+    struct stat st;
+    void *base;
+
+    seg->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (seg->fd < 0)
+    {
+        return -1;
+    }
+
+    if (fstat(seg->fd, &st) < 0 || (uint64_t)st.st_size != STORE_SEGMENT_SIZE)
+    {
+        close(seg->fd);
+        return -1;
+    }
+
+    base = mmap(NULL, STORE_SEGMENT_SIZE, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, seg->fd, 0);
+    if (base == MAP_FAILED)
+    {
+        close(seg->fd);
+        return -1;
+    }
+
+    seg->header = base;
+    seg->records = (struct store_record *)((uint8_t *)base + STORE_HEADER_SIZE);
+    if (seg->header->magic != STORE_MAGIC || seg->header->version != STORE_VERSION ||
+        seg->header->record_size != sizeof(struct store_record) || seg->header->capacity != STORE_SEGMENT_RECORDS)
+    {
+        munmap(base, STORE_SEGMENT_SIZE);
+        close(seg->fd);
+        return -1;
+    }
+    return 0;
+}
+
+void store_segment_close(struct store_segment *seg)
+{
+    if (seg->header != NULL)
+    {
+        munmap(seg->header, STORE_SEGMENT_SIZE);
+        close(seg->fd);
+        seg->header = NULL;
+        seg->records = NULL;
+    }
+}
+
+int store_segment_open(const char *dir, uint32_t index, struct store_segment *seg)
+{
+    char path[300];
+
+    segment_path(path, sizeof(path), dir, index);
+    seg->index = index;
+    seg->header = NULL;
+    return segment_map(seg, path, 0);
+}
+
+long store_last_index(const char *dir)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+    unsigned int index;
+    long last = -1;
+    char suffix[8];
+
+    if (d == NULL)
+    {
+        return -1;
+    }
+
+    while ((e = readdir(d)) != NULL)
+    {
+        if (sscanf(e->d_name, "%8u.%4s", &index, suffix) == 2 && strcmp(suffix, "seg") == 0 && (long)index > last)
+        {
+            last = index;
+        }
+    }
+    closedir(d);
+    return last;
+}
+
+/* Accounts for the record about to be at position n */
+static void header_add(struct store_header *h, const struct store_record *r, uint32_t n)
+{
+    uint32_t block = n / STORE_BLOCK_RECORDS;
+    int first = n % STORE_BLOCK_RECORDS == 0;
+
+    if (n == 0 || r->sampled < h->min_sampled)
+    {
+        h->min_sampled = r->sampled;
+    }
+    if (n == 0 || r->sampled > h->max_sampled)
+    {
+        h->max_sampled = r->sampled;
+    }
+    if (first || r->sampled < h->block_min[block])
+    {
+        h->block_min[block] = r->sampled;
+    }
+    if (first || r->sampled > h->block_max[block])
+    {
+        h->block_max[block] = r->sampled;
+    }
+    if (r->node_id < STORE_NODES)
+    {
+        h->nodes[r->node_id / 8] |= 1 << (r->node_id % 8);
+    }
+}
+
+/*
+ * The count of the header may be behind the records, or ahead of them if
+ * the header page reached the disk first. The valid prefix of the records
+ * is the truth: the header is rebuilt from it and what follows is zeroed.
+ */
+static void segment_recover(struct store_segment *seg)
+{
+    struct store_header *h = seg->header;
+    uint32_t old = atomic_load_explicit(&h->count, memory_order_relaxed);
+    uint32_t n;
+    uint32_t i;
+    const uint8_t *tail;
+    size_t tail_len;
+
+    memset(h->nodes, 0, sizeof(h->nodes));
+    for (n = 0; n < STORE_SEGMENT_RECORDS && store_record_valid(&seg->records[n]); n++)
+    {
+        header_add(h, &seg->records[n], n);
+    }
+    atomic_store_explicit(&h->count, n, memory_order_release);
+
+    tail = (const uint8_t *)&seg->records[n];
+    tail_len = (size_t)(STORE_SEGMENT_RECORDS - n) * sizeof(struct store_record);
+    for (i = 0; i < tail_len && tail[i] == 0; i++)
+    {
+    }
+    if (i < tail_len)
+    {
+        memset(&seg->records[n], 0, tail_len);
+    }
+
+    if (n != old || i < tail_len)
+    {
+        printf("Segment %u recovered with %u records, header said %u%s\n",
+               seg->index, n, old, i < tail_len ? ", torn tail cut off" : "");
+    }
+}
+
+static int segment_create(struct store *s, uint32_t index)
+{
+    struct store_segment *seg = &s->active;
+    struct store_header h;
+    char path[300];
+    int fd;
+
+    segment_path(path, sizeof(path), s->dir, index);
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    /* The whole segment is allocated now, appends never grow the file */
+    memset(&h, 0, sizeof(h));
+    h.magic = STORE_MAGIC;
+    h.version = STORE_VERSION;
+    h.record_size = sizeof(struct store_record);
+    h.capacity = STORE_SEGMENT_RECORDS;
+    if (ftruncate(fd, STORE_SEGMENT_SIZE) < 0 || pwrite(fd, &h, sizeof(h), 0) != sizeof(h))
+    {
+        close(fd);
+        unlink(path);
+        return -1;
+    }
+    close(fd);
+
+    seg->index = index;
+    s->segments++;
+    return segment_map(seg, path, 1);
+}
+
+/* Seals the full active segment and starts the next one */
+static int segment_rotate(struct store *s)
+{
+    uint32_t next = s->active.index + 1;
+
+    msync(s->active.header, STORE_SEGMENT_SIZE, MS_SYNC);
+    s->active.header->sealed = 1;
+    msync(s->active.header, STORE_HEADER_SIZE, MS_SYNC);
+    store_segment_close(&s->active);
+    return segment_create(s, next);
+}
+
+int store_open(struct store *s, const char *dir)
+{
+    char path[300];
+    long last;
+
+    memset(s, 0, sizeof(*s));
+    snprintf(s->dir, sizeof(s->dir), "%s", dir);
+
+    if (mkdir(dir, 0755) < 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    last = store_last_index(dir);
+    if (last < 0)
+    {
+        return segment_create(s, 0);
+    }
+
+    /* Appending goes on in the last segment unless it was sealed */
+    segment_path(path, sizeof(path), dir, last);
+    s->active.index = last;
+    if (segment_map(&s->active, path, 1) < 0)
+    {
+        printf("Segment %ld is not valid, starting a new one\n", last);
+        return segment_create(s, last + 1);
+    }
+    if (s->active.header->sealed || store_count(s->active.header) >= STORE_SEGMENT_RECORDS)
+    {
+        return segment_rotate(s);
+    }
+    segment_recover(&s->active);
+    return 0;
+}
+
+int store_append(struct store *s, const ssn_record_t *r, uint16_t ch_id, uint64_t received)
+{
+    struct store_record *rec;
+    struct store_header *h;
+    uint32_t n;
+    uint64_t age_ms = (uint64_t)r->age * 100;
+
+    if (s->active.header == NULL)
+    {
+        return -1;
+    }
+
+    /* Only this thread writes the count, it can read it relaxed */
+    n = atomic_load_explicit(&s->active.header->count, memory_order_relaxed);
+    if (n >= STORE_SEGMENT_RECORDS)
+    {
+        if (segment_rotate(s) < 0)
+        {
+            return -1;
+        }
+        n = 0;
+    }
+
+    h = s->active.header;
+    rec = &s->active.records[n];
+    rec->sampled = received > age_ms ? received - age_ms : 0;
+    rec->received = received;
+    rec->node_id = r->node_id;
+    rec->seq = r->seq;
+    rec->ch_id = ch_id;
+    rec->kind = r->kind;
+    rec->reserved = 0;
+    rec->value = r->value;
+    rec->age = r->age;
+    rec->check = record_check(rec);
+
+    /* The readers trust the records below the count: it is published last */
+    header_add(h, rec, n);
+    atomic_store_explicit(&h->count, n + 1, memory_order_release);
+
+    counter_add(&s->appended, 1);
+    return 0;
+}
+
+void store_flush(struct store *s)
+{
+    if (s->active.header != NULL)
+    {
+        msync(s->active.header, STORE_SEGMENT_SIZE, MS_ASYNC);
+    }
+}
+
+void store_close(struct store *s)
+{
+    if (s->active.header != NULL)
+    {
+        msync(s->active.header, STORE_SEGMENT_SIZE, MS_SYNC);
+        store_segment_close(&s->active);
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * Append-only store of the delivered readings.
+ *
+ * Readings go to segment files of STORE_SEGMENT_RECORDS fixed-width
+ * records in a directory, named by their index:
+ *
+ *   +-----------------------+----------+----------+-----+
+ *   | header, one page      | record 0 | record 1 | ... |
+ *   +-----------------------+----------+----------+-----+
+ *
+ * A segment is created at its full size and written through a shared
+ * mapping, so an append is a copy into the page cache and a reader maps
+ * the file and uses the records in place. The header keeps the number of
+ * records, the range of their sample times and a bitmap of the nodes they
+ * come from, so that a query can skip a segment without reading it. It
+ * also keeps the range of sample times of every block of
+ * STORE_BLOCK_RECORDS records, a sparse index to skip parts of a segment.
+ *
+ * There is a single writer and no lock: the count is stored with release
+ * semantics after the record and the rest of the header, so a reader that
+ * loads it with store_count sees them complete for every record below it.
+ *
+ * Nothing is synced per record: the store is flushed asynchronously with
+ * store_flush and a full segment is synced before the next one is created.
+ * Every record carries a checksum. When the store is opened again, the
+ * last segment is scanned and a torn tail is cut off.
+ */
+
+#ifndef STORE_H_
+#define STORE_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include "../Common/ssn-proto.h"
+#include "counter.h"
+
+#define STORE_MAGIC 0x53534e53 /* "SSNS" */
+#define STORE_VERSION 2
+#define STORE_HEADER_SIZE 4096
+#define STORE_SEGMENT_RECORDS 65536
+#define STORE_SEGMENT_SIZE (STORE_HEADER_SIZE + (uint64_t)STORE_SEGMENT_RECORDS * sizeof(struct store_record))
+
+/* Node ids indexed by the segment headers */
+#define STORE_NODES 1024
+
+/* Granularity of the sparse time index */
+#define STORE_BLOCK_RECORDS 1024
+#define STORE_BLOCKS (STORE_SEGMENT_RECORDS / STORE_BLOCK_RECORDS)
+
+/* 32 bytes, no padding, in the byte order of the collector */
+struct store_record
+{
+    uint64_t sampled;   /* ms since the epoch: reception time minus the age */
+    uint64_t received;  /* ms since the epoch, at the collector */
+    uint16_t node_id;
+    uint16_t seq;
+    uint16_t ch_id;     /* cluster head that sent the batch */
+    uint8_t kind;       /* with the delivery flags and the boot epoch */
+    uint8_t reserved;
+    int16_t value;
+    uint16_t age;       /* tenths of a second */
+    uint32_t check;     /* checksum of the fields above, never 0 */
+};
+
+struct store_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    _Atomic uint32_t count; /* records appended, published after them */
+    uint32_t sealed;      /* full and synced, the header can be trusted */
+    uint32_t reserved;
+    uint64_t min_sampled; /* range of the sample times of the records */
+    uint64_t max_sampled;
+    uint8_t nodes[STORE_NODES / 8]; /* bit n set: node n has records here */
+    uint64_t block_min[STORE_BLOCKS]; /* range of the sample times of each block */
+    uint64_t block_max[STORE_BLOCKS];
+};
+
+/* A mapped segment, read-only unless it is the one being written */
+struct store_segment
+{
+    uint32_t index;
+    int fd;
+    struct store_header *header;
+    struct store_record *records;
+};
+
+struct store
+{
+    char dir[256];
+    struct store_segment active;
+    _Atomic unsigned long appended; /* read live by the metrics */
+    unsigned long segments;         /* created since the store was opened */
+};
+
+/* Opens the store in dir, creating the directory, recovering the last segment */
+int store_open(struct store *s, const char *dir);
+
+/* Appends a delivered reading, returns -1 if no segment could be created */
+int store_append(struct store *s, const ssn_record_t *r, uint16_t ch_id, uint64_t received);
+
+/* Starts writing the dirty pages back, without waiting */
+void store_flush(struct store *s);
+
+/* Syncs and unmaps the active segment */
+void store_close(struct store *s);
+
+/* Maps segment index of dir read-only, returns -1 if it does not exist or is invalid */
+int store_segment_open(const char *dir, uint32_t index, struct store_segment *seg);
+void store_segment_close(struct store_segment *seg);
+
+/* Highest segment index in dir, -1 if there is none */
+long store_last_index(const char *dir);
+
+/* Returns 1 if the record is complete */
+int store_record_valid(const struct store_record *r);
+
+/* Records a reader can use, the header covers all of them */
+static inline uint32_t store_count(const struct store_header *h)
+{
+    return atomic_load_explicit(&h->count, memory_order_acquire);
+}
+
+static inline int store_has_node(const struct store_header *h, uint16_t node_id)
+{
+    return node_id < STORE_NODES && (h->nodes[node_id / 8] & (1 << (node_id % 8)));
+}
+
+#endif /* STORE_H_ */
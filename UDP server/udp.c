@@ -1,41 +1,215 @@
 #include <stdio.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+
+#include "ingest.h"
+#include "collector.h"
+#include "store.h"
+#include "query-server.h"
+#include "metrics-server.h"
 
-#define BUF_SIZE 100
+#define DEFAULT_PORT 7777
+#define DEFAULT_STORE "data"
+#define DEFAULT_METRICS_PORT 9110
+#define MAX_WORKERS 64
+/* Batches per worker: one being filled, the others queued for the collector stage */
+#define BATCHES_PER_WORKER 256
 
-struct sockaddr_in6 i6sock;
+static void usage(const char *name)
+{
+    printf("Usage: %s [-p port] [-w workers] [-d dir] [-n] [-q socket] [-m port] [-v]\n", name);
+    printf("  -p  UDP port of the collector, %d by default\n", DEFAULT_PORT);
+    printf("  -d  directory of the store, \"%s\" by default\n", DEFAULT_STORE);
+    printf("  -n  does not store the readings\n");
+    printf("  -q  unix socket of the queries, query.sock in the store directory by default\n");
+    printf("  -w  receive workers, one per core by default\n");
+    printf("  -m  HTTP port of the Prometheus metrics on 127.0.0.1, %d by default, 0 disables them\n",
+           DEFAULT_METRICS_PORT);
+    printf("  -v  prints every reading\n");
+}
 
-int main()
+int main(int argc, char *argv[])
 {
-    int sock = socket(AF_INET6, SOCK_DGRAM, 0);
-    int bytes_received = 0;
-    char buf[BUF_SIZE];
+    static struct ingest_worker workers[MAX_WORKERS];
+    struct collector collector;
+    static struct store store;
+    const char *store_dir = DEFAULT_STORE;
+    static struct query_server query_server;
+    char query_path[108] = "";
+    static struct metrics_server metrics_server;
+    struct metrics_source metrics_source;
+    in_port_t metrics_port = DEFAULT_METRICS_PORT;
+    struct ingest_batch *batches;
+    unsigned long datagrams = 0, records = 0, malformed = 0, ignored = 0, dropped = 0;
+    in_port_t port = DEFAULT_PORT;
+    int nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    int verbose = 0;
+    sigset_t signals;
+    int signum;
+    int opt;
+    int i;
+
+    while ((opt = getopt(argc, argv, "p:w:d:nq:m:vh")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        case 'd':
+            store_dir = optarg;
+            break;
+        case 'n':
+            store_dir = NULL;
+            break;
+        case 'q':
+            snprintf(query_path, sizeof(query_path), "%s", optarg);
+            break;
+        case 'm':
+            metrics_port = atoi(optarg);
+            break;
+        case 'v':
+            verbose = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : -1;
+        }
+    }
+
+    if (nworkers < 1)
+    {
+        nworkers = 1;
+    }
+    else if (nworkers > MAX_WORKERS)
+    {
+        nworkers = MAX_WORKERS;
+    }
 
-    //assign port number, family and address to the structure
-    in_port_t port = 7777;
-    sa_family_t family = AF_INET6;
+    /* Every batch is allocated up front, the receive path never allocates */
+    batches = calloc((size_t)nworkers * BATCHES_PER_WORKER, sizeof(*batches));
+    if (batches == NULL)
+    {
+        printf("Out of memory. Closing the server!\n");
+        return -1;
+    }
 
-    i6sock.sin6_port = htons(port);
-    i6sock.sin6_family = family;
-    i6sock.sin6_addr = in6addr_any;
+    /* A client closing its socket mid-answer gets EPIPE on the write, it does not stop the collector */
+    signal(SIGPIPE, SIG_IGN);
 
-    socklen_t addressLength = sizeof(struct sockaddr *);
+    /* The signals are taken by the main thread only, with sigwait */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
 
-    if (bind(sock, (struct sockaddr *)&i6sock, sizeof(i6sock)) < 0)
+    for (i = 0; i < nworkers; i++)
     {
-        printf("Error binding socket. Closing the server!\n");
+        if (ingest_open(&workers[i], i, port, &batches[i * BATCHES_PER_WORKER], BATCHES_PER_WORKER, &collector.bell) < 0)
+        {
+            printf("Error binding socket. Closing the server!\n");
+            return -1;
+        }
+    }
+
+    if (store_dir != NULL && store_open(&store, store_dir) < 0)
+    {
+        printf("Error opening the store in %s. Closing the server!\n", store_dir);
         return -1;
     }
 
-    printf("UDP server is running on port %d\n", port);
-    while (1)
+    /* The dashboards query the store while it is written */
+    if (store_dir != NULL)
     {
-        bytes_received = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *)&i6sock, (socklen_t *)&addressLength);
+        if (query_path[0] == '\0')
+        {
+            snprintf(query_path, sizeof(query_path), "%s/query.sock", store_dir);
+        }
+        if (query_server_start(&query_server, query_path, store_dir) < 0)
+        {
+            printf("Error listening on %s. Closing the server!\n", query_path);
+            return -1;
+        }
+    }
 
-        printf("\nData received: '%.*s'", bytes_received, buf);
+    collector.store = store_dir != NULL ? &store : NULL;
+    collector.workers = workers;
+    collector.nworkers = nworkers;
+    collector.verbose = verbose;
+    if (collector_start(&collector) < 0)
+    {
+        printf("Error starting the collector. Closing the server!\n");
+        return -1;
     }
 
+    metrics_source.workers = workers;
+    metrics_source.nworkers = nworkers;
+    metrics_source.store = collector.store;
+    if (metrics_port != 0 && metrics_server_start(&metrics_server, metrics_port, &metrics_source) < 0)
+    {
+        printf("Error listening on port %d for the metrics. Closing the server!\n", metrics_port);
+        return -1;
+    }
+
+    for (i = 0; i < nworkers; i++)
+    {
+        if (ingest_start(&workers[i]) < 0)
+        {
+            printf("Error starting worker %d. Closing the server!\n", i);
+            return -1;
+        }
+    }
+
+    printf("UDP server is running on port %d with %d workers\n", port, nworkers);
+    fflush(stdout);
+
+    /* Ctrl-C stops the workers, lets the collector stage drain and prints the delivery of the run */
+    sigwait(&signals, &signum);
+
+    for (i = 0; i < nworkers; i++)
+    {
+        ingest_stop(&workers[i]);
+        datagrams += counter_get(&workers[i].datagrams);
+        records += counter_get(&workers[i].records);
+        malformed += counter_get(&workers[i].malformed);
+        ignored += counter_get(&workers[i].ignored);
+        dropped += counter_get(&workers[i].dropped);
+    }
+    collector_stop(&collector);
+    if (metrics_port != 0)
+    {
+        metrics_server_stop(&metrics_server);
+    }
+
+    collector_summary();
+    printf("\nReceived %lu datagrams with %lu readings, %lu malformed, %lu ignored, %lu dropped\n",
+           datagrams, records, malformed, ignored, dropped);
+    for (i = 0; i < nworkers; i++)
+    {
+        printf("Worker %d: %lu datagrams, %lu batches, ring occupancy at most %u of %u, %lu dropped\n",
+               i, counter_get(&workers[i].datagrams), workers[i].full.pushed, workers[i].full.high, ring_capacity(&workers[i].full),
+               counter_get(&workers[i].dropped));
+    }
+    if (store_dir != NULL)
+    {
+        query_server_stop(&query_server);
+        printf("Served %lu queries on %s\n", query_server.served, query_path);
+        printf("Stored %lu readings in %s, segment %u holds %u\n",
+               counter_get(&store.appended), store_dir, store.active.index, store.active.header ? store_count(store.active.header) : 0);
+        store_close(&store);
+    }
+
+    for (i = 0; i < nworkers; i++)
+    {
+        ingest_free(&workers[i]);
+    }
+    free(batches);
     return 0;
 }